@@ -1,8 +1,35 @@
 HEADERS += ifingerprint.h \
-           secugen_sda04.h
+           secugen_sda04.h \
+           sda04_engine.h \
+           sda04_userindex.h \
+           sda04_templatestore.h \
+           sda04_synccheckpoint.h \
+           sda04_bitmap.h \
+           sda04_matcher.h \
+           sda04_template.h \
+           sda04_metrics.h \
+           sda04_readermanager.h \
+           sda04_quality.h \
+           sda04_enrollment.h \
+           sda04_archive.h \
+           sda04_recorder.h
 
-SOURCES += secugen_sda04.cpp
+SOURCES += secugen_sda04.cpp \
+           sda04_engine.cpp \
+           sda04_userindex.cpp \
+           sda04_templatestore.cpp \
+           sda04_synccheckpoint.cpp \
+           sda04_bitmap.cpp \
+           sda04_matcher.cpp \
+           sda04_template.cpp \
+           sda04_metrics.cpp \
+           sda04_readermanager.cpp \
+           sda04_quality.cpp \
+           sda04_enrollment.cpp \
+           sda04_archive.cpp \
+           sda04_recorder.cpp
 
-OTHER_FILES += fingerprint.pri
+OTHER_FILES += fingerprint.pri \
+               sda04_emulator.pri
 
 INCLUDEPATH += /mnt/rpi-rootfs/usr/local/include/
@@ -0,0 +1,87 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <QMetaObject>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+
+BenchSamples::BenchSamples(const QString &name) : name(name), failed(0)
+{
+}
+
+void BenchSamples::add(qint64 nsecs, bool ok)
+{
+    samples.append(nsecs);
+    if(!ok)
+        failed++;
+}
+
+qint64 BenchSamples::percentile(int p) const
+{
+    if(samples.isEmpty())
+        return 0;
+
+    QVector<qint64> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    // Nearest rank : smallest sample with at least p percent of the samples at or below it
+    int rank = (p * sorted.size() + 99) / 100;
+    return sorted.at(qBound(1, rank, sorted.size()) - 1);
+}
+
+void BenchSamples::report() const
+{
+    printf("%-28s n=%-5d p50=%9.3f ms  p99=%9.3f ms  max=%9.3f ms  failed=%d\n", qPrintable(name), samples.size(),
+           percentile(50) / 1e6, percentile(99) / 1e6, percentile(100) / 1e6, failed);
+    fflush(stdout);
+}
+
+BenchDevice::BenchDevice(QObject *device) : device(device)
+{
+    device->moveToThread(&thread);
+    QObject::connect(&thread, &QThread::finished, device, &QObject::deleteLater);
+    thread.start();
+}
+
+BenchDevice::~BenchDevice()
+{
+    QMetaObject::invokeMethod(device, "stop", Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+}
+
+bool BenchDevice::start()
+{
+    bool started = false;
+    QMetaObject::invokeMethod(device, "start", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, started));
+    QMetaObject::invokeMethod(device, "portName", Qt::BlockingQueuedConnection, Q_RETURN_ARG(QString, port));
+
+    return started;
+}
+
+QString BenchDevice::portName() const
+{
+    return port;
+}
+
+void benchReport(const QString &metric, double value, const QString &unit)
+{
+    printf("%-28s %12.2f %s\n", qPrintable(metric), value, qPrintable(unit));
+    fflush(stdout);
+}
+
+SecugenSda04 *benchReader(const QString &portName, const BenchOptions &options)
+{
+    // Commands are sent without waiting for a touch
+    SecugenSda04 *reader = new SecugenSda04(portName, SecugenSda04::NO_AUTOON);
+    reader->waitForReady();
+
+    if(reader->negotiateBaudRate(options.baudRate) == 0)
+    {
+        qCritical() << "No answer on " << portName;
+        delete reader;
+        return 0;
+    }
+
+    return reader;
+}
@@ -0,0 +1,78 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QObject>
+#include <QThread>
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+
+class SecugenSda04;
+
+struct BenchOptions
+{
+    BenchOptions() : iterations(50), users(200), population(10000), baudRate(115200), pacing(true),
+        captureDelay(0), seed(1), replaySpeed(1.0) {}
+
+    int iterations; // timed runs of each command
+    int users; // emulator database size
+    int population; // largest matcher population
+    qint32 baudRate; // link speed negotiated with the emulator
+    bool pacing; // emulator answers paced at the link speed
+    int captureDelay; // ms the emulator takes to capture a finger
+    quint32 seed;
+    double replaySpeed; // Sda04Replay::setSpeed()
+    QString capture; // Sda04Recorder file to replay, empty : one is recorded first
+};
+
+// Durations of one measurement, reported as nearest rank percentiles
+class BenchSamples
+{
+public:
+    explicit BenchSamples(const QString &name = QString());
+
+    void add(qint64 nsecs, bool ok = true);
+    int count() const { return samples.size(); }
+    int failures() const { return failed; }
+    // ns, 0 if empty
+    qint64 percentile(int p) const;
+    // One line : name, runs, p50, p99 and max in ms, failures
+    void report() const;
+
+private:
+    QString name;
+    QVector<qint64> samples;
+    int failed;
+};
+
+// Emulator or replay on its own thread : their captures and pacing block, the driver must not wait on them
+class BenchDevice
+{
+public:
+    // Takes the device, deleted with its thread
+    explicit BenchDevice(QObject *device);
+    ~BenchDevice();
+
+    bool start();
+    QString portName() const;
+
+private:
+    QThread thread;
+    QObject *device;
+    QString port;
+};
+
+// One result line : metric, value, unit
+void benchReport(const QString &metric, double value, const QString &unit);
+// Reader on the device's port, negotiated up to the options speed. Null if the device doesn't answer.
+SecugenSda04 *benchReader(const QString &portName, const BenchOptions &options);
+
+// Each suite prints its results and returns the number of failed checks
+int benchAck(const BenchOptions &options);
+int benchLatency(const BenchOptions &options);
+int benchExport(const BenchOptions &options);
+int benchMatcher(const BenchOptions &options);
+int benchImage(const BenchOptions &options);
+int benchReplay(const BenchOptions &options);
+
+#endif // BENCH_H
@@ -0,0 +1,109 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <sda04_engine.h>
+#include <random>
+
+namespace {
+
+enum {
+    ACK_COUNT = 4096, // distinct ACKs decoded per round
+    ROUND_SCALE = 20 // rounds per iteration of the options
+};
+
+// ACK decoding as DataContainer did it before Sda04Ack : hex strings built byte by byte, then parsed
+struct LegacyAck
+{
+    static QString hexByte(char byte)
+    {
+        return (QString::number(byte, 16).length() == 1)? ("0" + QString::number(byte, 16)) : QString::number(byte, 16);
+    }
+
+    static uint id(const QByteArray &ack)
+    {
+        bool ok;
+        QString hexId = hexByte(ack.at(3)) + hexByte(ack.at(2));
+        return hexId.toUInt(&ok, 10);
+    }
+
+    static uint packetSize(const QByteArray &ack)
+    {
+        bool ok;
+        QString hexSize = "0x" + hexByte(ack.at(9)) + hexByte(ack.at(8)) + hexByte(ack.at(7)) + hexByte(ack.at(6));
+        return hexSize.toUInt(&ok, 16);
+    }
+
+    static int error(const QByteArray &ack)
+    {
+        return ack.at(10);
+    }
+};
+
+}
+
+int benchAck(const BenchOptions &options)
+{
+    std::mt19937 random(options.seed);
+    QList<QByteArray> acks;
+    QVector<int> ids;
+    QVector<quint32> sizes;
+    int failures = 0;
+
+    // Identify and template answers : BCD user IDs, data packets up to a full image
+    for(int i = 0; i < ACK_COUNT; i++)
+    {
+        int userID = 1 + random() % 9999;
+        quint32 size = (i % 2)? random() % (260 * 300) : 0;
+        acks.append(Sda04Command((i % 2)? 0x73 : 0x56, Sda04Command::toBcd(userID), 0x0000, size).frame());
+        ids.append(userID);
+        sizes.append(size);
+    }
+
+    const int rounds = options.iterations * ROUND_SCALE;
+    volatile quint64 sink = 0;
+    QElapsedTimer clock;
+
+    clock.start();
+    for(int round = 0; round < rounds; round++)
+        for(int i = 0; i < ACK_COUNT; i++)
+            sink += LegacyAck::id(acks.at(i)) + LegacyAck::packetSize(acks.at(i)) + LegacyAck::error(acks.at(i));
+    const double legacy = (double)clock.nsecsElapsed() / rounds / ACK_COUNT;
+
+    clock.start();
+    for(int round = 0; round < rounds; round++)
+    {
+        for(int i = 0; i < ACK_COUNT; i++)
+        {
+            DataContainer container;
+            container.setAck(acks.at(i));
+            sink += container.id() + container.packetSize() + container.error();
+        }
+    }
+    const double dataContainer = (double)clock.nsecsElapsed() / rounds / ACK_COUNT;
+
+    clock.start();
+    for(int round = 0; round < rounds; round++)
+    {
+        for(int i = 0; i < ACK_COUNT; i++)
+        {
+            Sda04Ack ack(acks.at(i));
+            sink += ack.userId() + ack.packetSize() + ack.error() + ack.checkSumValid();
+        }
+    }
+    const double view = (double)clock.nsecsElapsed() / rounds / ACK_COUNT;
+    Q_UNUSED(sink);
+
+    // Decoded fields must still be the encoded ones
+    for(int i = 0; i < ACK_COUNT; i++)
+    {
+        Sda04Ack ack(acks.at(i));
+        if(ack.userId() != ids.at(i) || ack.packetSize() != sizes.at(i))
+            failures++;
+    }
+
+    benchReport("ack decode legacy", legacy, "ns/ack");
+    benchReport("ack decode DataContainer", dataContainer, "ns/ack");
+    benchReport("ack decode Sda04Ack", view, "ns/ack");
+    benchReport("ack decode speedup", view > 0? legacy / view : 0, "x");
+
+    return failures;
+}
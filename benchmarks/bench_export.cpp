@@ -0,0 +1,97 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <sda04_emulator.h>
+#include <QQueue>
+
+namespace {
+
+void reportTransfer(const QString &name, int templates, qint64 bytes, qint64 nsecs)
+{
+    const double seconds = qMax<qint64>(1, nsecs) / 1e9;
+
+    benchReport(name + " templates", templates / seconds, "templates/s");
+    benchReport(name + " bytes", bytes / 1024.0 / seconds, "KB/s");
+}
+
+}
+
+// Database export : one user at a time as base64 (the text API), binary into a reused buffer, then pipelined
+int benchExport(const BenchOptions &options)
+{
+    Sda04Emulator *emulator = new Sda04Emulator(options.seed);
+    emulator->populate(options.users);
+    emulator->setPacing(options.pacing);
+
+    BenchDevice device(emulator);
+    if(!device.start())
+        return 1;
+
+    SecugenSda04 *reader = benchReader(device.portName(), options);
+    if(!reader)
+        return 1;
+
+    const QList<int> ids = reader->getuserIDs();
+    int failures = (ids.size() == options.users)? 0 : 1;
+    QElapsedTimer clock;
+    qint64 bytes = 0;
+
+    clock.start();
+    foreach(int userID, ids)
+    {
+        QString hash;
+        if(reader->getHashUser(userID, hash) != 0)
+            failures++;
+        bytes += QByteArray::fromBase64(hash.toLatin1()).size();
+    }
+    reportTransfer("export base64", ids.size(), bytes, clock.nsecsElapsed());
+
+    // The buffer keeps its capacity from one user to the next
+    QByteArray templates;
+    templates.reserve(2 * Sda04Emulator::syntheticTemplate(1).size());
+    bytes = 0;
+
+    clock.start();
+    foreach(int userID, ids)
+    {
+        if(reader->getTemplate(userID, templates) != 0)
+            failures++;
+        bytes += templates.size();
+    }
+    reportTransfer("export binary", ids.size(), bytes, clock.nsecsElapsed());
+
+    // SYNC_WINDOW requests queued : the reader never waits for the host between two users
+    QQueue<Sda04Reply *> window;
+    int next = 0;
+    bytes = 0;
+
+    clock.start();
+    while(next < ids.size() || !window.isEmpty())
+    {
+        while(next < ids.size() && window.size() < SecugenSda04::SYNC_WINDOW)
+            window.enqueue(reader->getTemplateAsync(ids.at(next++)));
+
+        Sda04Reply *reply = window.dequeue();
+        reply->waitForFinished();
+        QByteArray received = reply->result().toByteArray();
+        if(received.isEmpty())
+            failures++;
+        bytes += received.size();
+        delete reply;
+    }
+    reportTransfer("export pipelined", ids.size(), bytes, clock.nsecsElapsed());
+
+    delete reader;
+
+    // Host cost of the text API alone, on the same templates
+    const QByteArray sample = Sda04Emulator::syntheticTemplate(1) + Sda04Emulator::syntheticTemplate(1);
+    const int rounds = options.iterations * 1000;
+    volatile int sink = 0;
+
+    clock.start();
+    for(int i = 0; i < rounds; i++)
+        sink += QByteArray::fromBase64(QString::fromLatin1(sample.toBase64()).toLatin1()).size();
+    benchReport("base64 round trip", (double)clock.nsecsElapsed() / rounds, "ns/template");
+    Q_UNUSED(sink);
+
+    return failures;
+}
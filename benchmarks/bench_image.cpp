@@ -0,0 +1,105 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <sda04_emulator.h>
+#include <sda04_bitmap.h>
+#include <QImage>
+#include <cmath>
+#include <random>
+
+namespace {
+
+// Ridges and valleys with sensor noise : compresses like a capture, unlike the emulator's test pattern
+QImage ridges(int imageSize, quint32 seed)
+{
+    const int width = Sda04Bitmap::width(imageSize);
+    const int height = Sda04Bitmap::height(imageSize);
+    QImage image(width, height, QImage::Format_Grayscale8);
+    std::mt19937 random(seed);
+
+    for(int y = 0; y < height; y++)
+    {
+        uchar *line = image.scanLine(y);
+        for(int x = 0; x < width; x++)
+        {
+            // Concentric ridges about 9 pixels apart around the core
+            double radius = std::sqrt((double)(x - width / 2) * (x - width / 2) + 1.5 * (y - height / 2) * (y - height / 2));
+            int level = 128 + (int)(90 * std::sin(radius * 2 * M_PI / 9)) + (int)(random() % 17) - 8;
+            line[x] = qBound(0, level, 255);
+        }
+    }
+
+    return image;
+}
+
+}
+
+// Capture transfer as BMP or PNG, then the codec alone : throughput and size against the BMP
+int benchImage(const BenchOptions &options)
+{
+    Sda04Emulator *emulator = new Sda04Emulator(options.seed);
+    emulator->setCaptureDelay(options.captureDelay);
+    emulator->setPacing(options.pacing);
+
+    BenchDevice device(emulator);
+    if(!device.start())
+        return 1;
+
+    SecugenSda04 *reader = benchReader(device.portName(), options);
+    if(!reader)
+        return 1;
+
+    BenchSamples bmp("image bmp");
+    BenchSamples png("image png");
+    qint64 pngBytes = 0;
+    QElapsedTimer clock;
+
+    for(int i = 0; i < options.iterations; i++)
+    {
+        QByteArray img;
+        clock.start();
+        reader->getImage(img, SecugenSda04::IMAGE_FULL_SIZE);
+        bmp.add(clock.nsecsElapsed(), img.size() == Sda04Bitmap::fileSize(SecugenSda04::IMAGE_FULL_SIZE));
+        reader->releaseImage(img);
+
+        clock.start();
+        QByteArray encoded = reader->getImageEncoded(SecugenSda04::IMAGE_PNG, SecugenSda04::IMAGE_FULL_SIZE).result();
+        png.add(clock.nsecsElapsed(), !encoded.isEmpty());
+        pngBytes += encoded.size();
+    }
+
+    delete reader;
+
+    bmp.report();
+    png.report();
+
+    int failures = bmp.failures() + png.failures();
+
+    // Codec on its own, on both capture sizes
+    const int sizes[] = { SecugenSda04::IMAGE_FULL_SIZE, SecugenSda04::IMAGE_HALF_SIZE };
+    for(int s = 0; s < 2; s++)
+    {
+        const QString name = (sizes[s] == SecugenSda04::IMAGE_FULL_SIZE)? "full" : "half";
+        const QImage image = ridges(sizes[s], options.seed);
+        qint64 encodedBytes = 0;
+
+        clock.start();
+        for(int i = 0; i < options.iterations; i++)
+        {
+            QByteArray encoded = Sda04Bitmap::encode(image, "png");
+            if(encoded.isEmpty())
+                failures++;
+            encodedBytes += encoded.size();
+        }
+        const double seconds = qMax<qint64>(1, clock.nsecsElapsed()) / 1e9;
+        const double raw = (double)Sda04Bitmap::rawSize(sizes[s]) * options.iterations;
+
+        benchReport("png encode " + name, raw / (1024 * 1024) / seconds, "MB/s");
+        benchReport("png ratio " + name, encodedBytes > 0? (double)Sda04Bitmap::fileSize(sizes[s]) * options.iterations / encodedBytes : 0, "bmp/png");
+    }
+
+    // The emulator's pattern, as received
+    if(pngBytes > 0)
+        benchReport("png ratio emulator", (double)Sda04Bitmap::fileSize(SecugenSda04::IMAGE_FULL_SIZE) * options.iterations / pngBytes, "bmp/png");
+
+    return failures;
+}
@@ -0,0 +1,65 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <sda04_emulator.h>
+#include <sda04_bitmap.h>
+
+// End to end command latency through the engine thread, the serial link and the emulator
+int benchLatency(const BenchOptions &options)
+{
+    Sda04Emulator *emulator = new Sda04Emulator(options.seed);
+    emulator->populate(options.users);
+    emulator->setIdentifyUser(1);
+    emulator->setCaptureDelay(options.captureDelay);
+    emulator->setPacing(options.pacing);
+
+    BenchDevice device(emulator);
+    if(!device.start())
+        return 1;
+
+    SecugenSda04 *reader = benchReader(device.portName(), options);
+    if(!reader)
+        return 1;
+
+    BenchSamples identify("identify 0x56");
+    BenchSamples verify("verify 0x55");
+    BenchSamples userIDs("user IDs 0x7d");
+    BenchSamples image("image full 0x43");
+    BenchSamples registration("register user 0x71");
+    const QString hash = QString::fromLatin1((Sda04Emulator::syntheticTemplate(options.users + 1) + Sda04Emulator::syntheticTemplate(options.users + 1)).toBase64());
+    QElapsedTimer clock;
+
+    for(int i = 0; i < options.iterations; i++)
+    {
+        clock.start();
+        bool ok = (reader->scanFinger().toInt() == 1);
+        identify.add(clock.nsecsElapsed(), ok);
+
+        clock.start();
+        ok = reader->verifyFinger(1);
+        verify.add(clock.nsecsElapsed(), ok);
+
+        clock.start();
+        ok = (reader->getuserIDs().size() >= options.users);
+        userIDs.add(clock.nsecsElapsed(), ok);
+
+        QByteArray img;
+        clock.start();
+        reader->getImage(img, SecugenSda04::IMAGE_FULL_SIZE);
+        image.add(clock.nsecsElapsed(), img.size() == Sda04Bitmap::fileSize(SecugenSda04::IMAGE_FULL_SIZE));
+        reader->releaseImage(img);
+
+        clock.start();
+        ok = (reader->registerUser(hash, options.users + 1, true) == 0);
+        registration.add(clock.nsecsElapsed(), ok);
+    }
+
+    delete reader;
+
+    identify.report();
+    verify.report();
+    userIDs.report();
+    image.report();
+    registration.report();
+
+    return identify.failures() + verify.failures() + userIDs.failures() + image.failures() + registration.failures();
+}
@@ -0,0 +1,102 @@
+#include "bench.h"
+#include <sda04_matcher.h>
+#include <sda04_emulator.h>
+#include <QtEndian>
+#include <cmath>
+
+namespace {
+
+enum {
+    PROBE_ROTATION = 6, // ANSI angle units (12 degrees), a rotation bin center of the matcher
+    PROBE_SHIFT_X = 9, // pixels
+    PROBE_SHIFT_Y = -7,
+    IMAGE_WIDTH = 260,
+    IMAGE_HEIGHT = 300
+};
+
+// Another touch of the same finger : the synthetic template turned about the image center and shifted.
+// ANSI378 : y grows downward and angles run counterclockwise. Minutiae pushed off the image are dropped.
+QByteArray touch(const QByteArray &synthetic)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(synthetic.constData());
+    const int minutiae = p[29];
+    const double theta = PROBE_ROTATION * 2.0 * M_PI / 180.0;
+    const double c = std::cos(theta), s = std::sin(theta);
+
+    QByteArray probe = synthetic.left(30);
+    int kept = 0;
+
+    for(int i = 0; i < minutiae; i++)
+    {
+        const uchar *m = p + 30 + i * 6;
+        double dx = (((m[0] & 0x3F) << 8) | m[1]) - IMAGE_WIDTH / 2;
+        double dy = (((m[2] & 0x3F) << 8) | m[3]) - IMAGE_HEIGHT / 2;
+        int x = qRound(IMAGE_WIDTH / 2 + c * dx + s * dy) + PROBE_SHIFT_X;
+        int y = qRound(IMAGE_HEIGHT / 2 - s * dx + c * dy) + PROBE_SHIFT_Y;
+
+        if(x < 0 || x >= IMAGE_WIDTH || y < 0 || y >= IMAGE_HEIGHT)
+            continue;
+
+        uchar moved[6];
+        moved[0] = (m[0] & 0xC0) | (x >> 8);
+        moved[1] = x & 0xFF;
+        moved[2] = (m[2] & 0xC0) | (y >> 8);
+        moved[3] = y & 0xFF;
+        moved[4] = (m[4] + PROBE_ROTATION) % 180;
+        moved[5] = m[5];
+        probe.append(reinterpret_cast<const char*>(moved), 6);
+        kept++;
+    }
+
+    // No extended data
+    probe.append(QByteArray(2, 0x00));
+
+    uchar *header = reinterpret_cast<uchar*>(probe.data());
+    header[29] = kept;
+    qToBigEndian<quint16>(probe.size(), header + 8);
+
+    return probe;
+}
+
+}
+
+// 1:N identification of rotated and shifted touches, at growing populations
+int benchMatcher(const BenchOptions &options)
+{
+    static const int populations[] = { 100, 1000, 10000 };
+    int failures = 0;
+
+    for(uint p = 0; p < sizeof(populations) / sizeof(populations[0]); p++)
+    {
+        const int population = qMin(populations[p], options.population);
+        if(p > 0 && population <= qMin(populations[p - 1], options.population))
+            break;
+
+        Sda04Matcher matcher;
+        for(int userID = 1; userID <= population; userID++)
+            matcher.add(userID, Sda04Emulator::syntheticTemplate(userID));
+
+        BenchSamples identify(QString("identify %1 templates").arg(population));
+        QElapsedTimer total;
+        QElapsedTimer clock;
+
+        total.start();
+        for(int i = 0; i < options.iterations; i++)
+        {
+            // Targets spread over the population
+            const int target = 1 + (int)((qint64)i * 7919 % population);
+            const QByteArray probe = touch(Sda04Emulator::syntheticTemplate(target));
+
+            clock.start();
+            QList<Sda04Matcher::Match> matches = matcher.identify(probe);
+            identify.add(clock.nsecsElapsed(), !matches.isEmpty() && matches.first().userID == target);
+        }
+        const double seconds = qMax<qint64>(1, total.nsecsElapsed()) / 1e9;
+
+        identify.report();
+        benchReport(QString("matches %1 templates").arg(population), (double)matcher.count() * options.iterations / seconds, "matches/s");
+        failures += identify.failures();
+    }
+
+    return failures;
+}
@@ -0,0 +1,150 @@
+#include "bench.h"
+#include <secugen_sda04.h>
+#include <sda04_emulator.h>
+#include <sda04_replay.h>
+#include <sda04_recorder.h>
+#include <QDir>
+#include <QMap>
+#include <QtEndian>
+#include <QDebug>
+
+namespace {
+
+// Identify, verify, user list and template read, recorded against the emulator
+bool record(const QString &fileName, const BenchOptions &options)
+{
+    Sda04Emulator *emulator = new Sda04Emulator(options.seed);
+    emulator->populate(options.users);
+    emulator->setIdentifyUser(1);
+    emulator->setCaptureDelay(options.captureDelay);
+    emulator->setPacing(options.pacing);
+
+    BenchDevice device(emulator);
+    if(!device.start())
+        return false;
+
+    SecugenSda04 *reader = benchReader(device.portName(), options);
+    if(!reader)
+        return false;
+
+    // After the speed negotiation : the capture only holds the script
+    bool recording = reader->startRecording(fileName);
+    QByteArray templates;
+
+    for(int i = 0; recording && i < options.iterations; i++)
+    {
+        reader->scanFinger();
+        reader->verifyFinger(1);
+        reader->getuserIDs();
+        reader->getTemplate(1 + i % options.users, templates);
+    }
+
+    reader->stopRecording();
+    delete reader;
+
+    return recording;
+}
+
+}
+
+// A capture played back by Sda04Replay, its commands sent again through a bare engine : per command latency
+// of the driver for a field trace, repeatable and without a reader
+int benchReplay(const BenchOptions &options)
+{
+    QString fileName = options.capture;
+
+    if(fileName.isEmpty())
+    {
+        fileName = QDir::tempPath() + "/sda04-bench.trc";
+        if(!record(fileName, options))
+            return 1;
+    }
+
+    const QList<Sda04Recorder::Record> records = Sda04Recorder::load(fileName);
+
+    Sda04Replay *replay = new Sda04Replay();
+    if(!replay->load(fileName))
+    {
+        delete replay;
+        return 1;
+    }
+    replay->setSpeed(options.replaySpeed);
+
+    BenchDevice device(replay);
+    if(!device.start())
+        return 1;
+
+    // Speed of the capture, for the engine's port only : the pseudo terminal has none
+    qint32 baudRate = QSerialPort::Baud9600;
+    foreach(const Sda04Recorder::Record &r, records)
+    {
+        if(r.type == Sda04Recorder::RECORD_SPEED && r.data.size() == 4) {
+            baudRate = qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(r.data.constData()));
+            break;
+        }
+    }
+
+    QThread engineThread;
+    Sda04Engine *engine = new Sda04Engine(device.portName());
+    engine->moveToThread(&engineThread);
+    QObject::connect(&engineThread, &QThread::finished, engine, &QObject::deleteLater);
+    engineThread.start();
+
+    bool opened = false;
+    QMetaObject::invokeMethod(engine, "openSession", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, opened), Q_ARG(qint32, baudRate));
+
+    QMap<int, BenchSamples> samples;
+    int failures = opened? 0 : 1;
+    QElapsedTimer clock;
+
+    for(int i = 0; opened && i < records.size(); i++)
+    {
+        if(records.at(i).type != Sda04Recorder::RECORD_WRITE || records.at(i).data.size() != 12)
+            continue;
+
+        // Command frame, then its data packet in the next write when it announces one
+        Sda04Ack frame(records.at(i).data);
+        Sda04Command command(frame.command(), frame.param1(), frame.param2(), frame.packetSize());
+
+        if(command.extraData > 0)
+        {
+            int data = i + 1;
+            while(data < records.size() && records.at(data).type != Sda04Recorder::RECORD_WRITE)
+                data++;
+            if(data < records.size())
+                command.data = records.at(data).data;
+            i = data;
+        }
+
+        const int cmd = (uchar)command.cmd;
+        if(!samples.contains(cmd))
+            samples.insert(cmd, BenchSamples(QString("replay 0x%1").arg(cmd, 2, 16, QChar('0'))));
+
+        clock.start();
+        Sda04Reply *reply = engine->submit(command);
+        reply->waitForFinished();
+        samples[cmd].add(clock.nsecsElapsed(), !reply->timedOut() && reply->error() >= 0);
+        delete reply;
+    }
+
+    QMetaObject::invokeMethod(engine, "closeSession", Qt::BlockingQueuedConnection);
+    engineThread.quit();
+    engineThread.wait();
+
+    bool ended = false;
+    int mismatches = 0;
+    QMetaObject::invokeMethod(replay, "atEnd", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ended));
+    QMetaObject::invokeMethod(replay, "mismatches", Qt::BlockingQueuedConnection, Q_RETURN_ARG(int, mismatches));
+
+    foreach(const BenchSamples &s, samples.values())
+    {
+        s.report();
+        failures += s.failures();
+    }
+    benchReport("replay mismatches", mismatches, "writes");
+
+    if(!ended)
+        qWarning() << "Replay : capture not played to its end";
+
+    return failures + mismatches + (ended? 0 : 1);
+}
@@ -0,0 +1,24 @@
+# Benchmarks of the SDA04 driver, run against Sda04Emulator (no reader or GPIO needed) :
+#   ./sda04-bench [suite...] --help
+QT += core gui serialport concurrent
+QT -= widgets
+
+TEMPLATE = app
+TARGET = sda04-bench
+
+CONFIG += console c++11 sda04_no_wiringpi
+CONFIG -= app_bundle
+
+include(../fingerprint.pri)
+include(../sda04_emulator.pri)
+
+HEADERS += bench.h
+
+SOURCES += main.cpp \
+           bench.cpp \
+           bench_ack.cpp \
+           bench_latency.cpp \
+           bench_export.cpp \
+           bench_matcher.cpp \
+           bench_image.cpp \
+           bench_replay.cpp
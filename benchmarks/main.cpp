@@ -0,0 +1,107 @@
+#include "bench.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStringList>
+#include <QStandardPaths>
+#include <cstdio>
+
+namespace {
+
+struct Suite
+{
+    const char *name;
+    const char *description;
+    int (*run)(const BenchOptions &options);
+};
+
+const Suite suites[] = {
+    { "ack", "ACK decoding : hex strings, DataContainer, Sda04Ack view", benchAck },
+    { "latency", "p50 / p99 of identify, verify, user list, image and registration", benchLatency },
+    { "export", "template export throughput : base64, binary, pipelined", benchExport },
+    { "matcher", "1:N identification, matches per second", benchMatcher },
+    { "image", "capture as BMP or PNG, codec throughput and compression ratio", benchImage },
+    { "replay", "per command latency of a replayed capture", benchReplay }
+};
+
+const int suiteCount = sizeof(suites) / sizeof(suites[0]);
+
+}
+
+int main(int argc, char *argv[])
+{
+    // Speeds negotiated with the emulator stay out of the settings of the real readers
+    QStandardPaths::setTestModeEnabled(true);
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("sda04-bench");
+
+    QString description = "SDA04 driver benchmarks against Sda04Emulator. Suites :";
+    for(int i = 0; i < suiteCount; i++)
+        description += QString("\n  %1 : %2").arg(suites[i].name).arg(suites[i].description);
+
+    BenchOptions options;
+    QCommandLineParser parser;
+    parser.setApplicationDescription(description);
+    parser.addHelpOption();
+    parser.addPositionalArgument("suite", "Suites to run, all by default", "[suite...]");
+
+    QCommandLineOption iterations("iterations", "Timed runs of each measurement.", "n", QString::number(options.iterations));
+    QCommandLineOption users("users", "Users in the emulator database.", "n", QString::number(options.users));
+    QCommandLineOption population("population", "Largest matcher population (100, 1000, 10000).", "n", QString::number(options.population));
+    QCommandLineOption baudRate("baud", "Highest link speed negotiated with the emulator.", "rate", QString::number(options.baudRate));
+    QCommandLineOption noPacing("no-pacing", "Emulator answers as fast as the pseudo terminal takes them.");
+    QCommandLineOption captureDelay("capture-delay", "ms the emulator takes to capture a finger.", "ms", QString::number(options.captureDelay));
+    QCommandLineOption seed("seed", "Seed of the emulator and of the synthetic data.", "n", QString::number(options.seed));
+    QCommandLineOption capture("capture", "Sda04Recorder capture to replay instead of recording one.", "file");
+    QCommandLineOption replaySpeed("replay-speed", "Replay speed factor, 0 : no delay.", "factor", QString::number(options.replaySpeed));
+
+    parser.addOption(iterations);
+    parser.addOption(users);
+    parser.addOption(population);
+    parser.addOption(baudRate);
+    parser.addOption(noPacing);
+    parser.addOption(captureDelay);
+    parser.addOption(seed);
+    parser.addOption(capture);
+    parser.addOption(replaySpeed);
+    parser.process(app);
+
+    options.iterations = qMax(1, parser.value(iterations).toInt());
+    options.users = qMax(1, parser.value(users).toInt());
+    options.population = qMax(1, parser.value(population).toInt());
+    options.baudRate = parser.value(baudRate).toInt();
+    options.pacing = !parser.isSet(noPacing);
+    options.captureDelay = qMax(0, parser.value(captureDelay).toInt());
+    options.seed = parser.value(seed).toUInt();
+    options.capture = parser.value(capture);
+    options.replaySpeed = qMax(0.0, parser.value(replaySpeed).toDouble());
+
+    QStringList selected = parser.positionalArguments();
+    foreach(const QString &name, selected)
+    {
+        bool known = false;
+        for(int i = 0; i < suiteCount; i++)
+            known |= (name == suites[i].name);
+
+        if(!known) {
+            fprintf(stderr, "Unknown suite %s\n", qPrintable(name));
+            return 2;
+        }
+    }
+
+    int failures = 0;
+    for(int i = 0; i < suiteCount; i++)
+    {
+        if(!selected.isEmpty() && !selected.contains(suites[i].name))
+            continue;
+
+        printf("== %s\n", suites[i].name);
+        fflush(stdout);
+        failures += suites[i].run(options);
+    }
+
+    if(failures > 0)
+        fprintf(stderr, "%d failed checks\n", failures);
+
+    return failures > 0? 1 : 0;
+}
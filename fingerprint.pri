@@ -1,9 +1,16 @@
 INCLUDEPATH += $$PWD
-QT += serialport
+QT += serialport concurrent
+CONFIG += c++11
 
 ###  DRIVERS ###
 
 ### Secugen SDA04 ###
-HEADERS                += $$PWD/secugen_sda04.h $$PWD/ifingerprint.h
-SOURCES                += $$PWD/secugen_sda04.cpp
-LIBS 		       += -lwiringPiDev -lwiringPi
+HEADERS                += $$PWD/secugen_sda04.h $$PWD/ifingerprint.h $$PWD/sda04_engine.h $$PWD/sda04_userindex.h $$PWD/sda04_templatestore.h $$PWD/sda04_synccheckpoint.h $$PWD/sda04_bitmap.h $$PWD/sda04_matcher.h $$PWD/sda04_template.h $$PWD/sda04_metrics.h $$PWD/sda04_readermanager.h $$PWD/sda04_quality.h $$PWD/sda04_enrollment.h $$PWD/sda04_archive.h $$PWD/sda04_recorder.h
+SOURCES                += $$PWD/secugen_sda04.cpp $$PWD/sda04_engine.cpp $$PWD/sda04_userindex.cpp $$PWD/sda04_templatestore.cpp $$PWD/sda04_synccheckpoint.cpp $$PWD/sda04_bitmap.cpp $$PWD/sda04_matcher.cpp $$PWD/sda04_template.cpp $$PWD/sda04_metrics.cpp $$PWD/sda04_readermanager.cpp $$PWD/sda04_quality.cpp $$PWD/sda04_enrollment.cpp $$PWD/sda04_archive.cpp $$PWD/sda04_recorder.cpp
+
+# CONFIG += sda04_no_wiringpi : build without GPIO, e.g. against Sda04Emulator (sda04_emulator.pri) on a desktop
+sda04_no_wiringpi {
+    DEFINES            += SDA04_NO_WIRINGPI
+} else {
+    LIBS 		       += -lwiringPiDev -lwiringPi
+}
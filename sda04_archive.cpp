@@ -0,0 +1,189 @@
+#include "sda04_archive.h"
+#include "sda04_templatestore.h"
+#include <QtEndian>
+#include <QDebug>
+
+static const char ARCHIVE_MAGIC[8] = { 'S', 'D', 'A', '0', '4', 'A', 'R', 'C' };
+
+Sda04ArchiveWriter::Sda04ArchiveWriter(const QString &fileName) : m_file(fileName), m_count(0), m_failed(false)
+{
+}
+
+bool Sda04ArchiveWriter::open(int format)
+{
+    if(!m_file.open(QIODevice::WriteOnly)) {
+        qCritical() << "Can't create archive " << m_file.fileName() << " : " << m_file.errorString();
+        return false;
+    }
+
+    uchar header[Sda04Archive::HEADER_SIZE] = {0};
+    memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    qToLittleEndian<quint16>(Sda04Archive::VERSION, header + 8);
+    qToLittleEndian<quint16>(format, header + 10);
+
+    m_count = 0;
+    m_failed = m_file.write(reinterpret_cast<const char*>(header), sizeof(header)) != sizeof(header);
+
+    return !m_failed;
+}
+
+bool Sda04ArchiveWriter::write(int userID, const char *directory, const QByteArray &templates)
+{
+    if(m_failed)
+        return false;
+
+    uchar header[Sda04Archive::ENTRY_HEADER_SIZE] = {0};
+    qToLittleEndian<quint32>(userID, header);
+    qToLittleEndian<quint32>(templates.size(), header + 4);
+    qToLittleEndian<quint32>(Sda04TemplateStore::digest(templates.constData(), templates.size()), header + 8);
+    if(directory)
+        memcpy(header + 12, directory, Sda04Archive::DIRECTORY_SIZE);
+
+    // Buffered by the file : one system write for many entries
+    m_failed = m_file.write(reinterpret_cast<const char*>(header), sizeof(header)) != sizeof(header)
+            || m_file.write(templates) != templates.size();
+
+    if(m_failed)
+        qCritical() << "Can't write archive " << m_file.fileName() << " : " << m_file.errorString();
+    else
+        m_count++;
+
+    return !m_failed;
+}
+
+bool Sda04ArchiveWriter::commit()
+{
+    if(m_failed) {
+        m_file.cancelWriting();
+        return false;
+    }
+
+    uchar trailer[Sda04Archive::TRAILER_SIZE];
+    qToLittleEndian<quint32>(Sda04Archive::END_MARK, trailer);
+    qToLittleEndian<quint32>(m_count, trailer + 4);
+
+    if(m_file.write(reinterpret_cast<const char*>(trailer), sizeof(trailer)) != sizeof(trailer) || !m_file.commit()) {
+        qCritical() << "Can't save archive " << m_file.fileName() << " : " << m_file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+Sda04ArchiveReader::Sda04ArchiveReader(const QString &fileName) : m_file(fileName), m_map(0), m_format(0)
+{
+}
+
+Sda04ArchiveReader::~Sda04ArchiveReader()
+{
+    close();
+}
+
+bool Sda04ArchiveReader::open()
+{
+    if(m_map)
+        return true;
+
+    if(!m_file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Can't open archive " << m_file.fileName() << " : " << m_file.errorString();
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+
+    if(size < Sda04Archive::HEADER_SIZE + Sda04Archive::TRAILER_SIZE || !(m_map = m_file.map(0, size))) {
+        qCritical() << "Can't read archive " << m_file.fileName();
+        m_file.close();
+        return false;
+    }
+
+    bool complete = false;
+    quint32 parsed = 0;
+
+    if(memcmp(m_map, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) == 0 && qFromLittleEndian<quint16>(m_map + 8) == Sda04Archive::VERSION)
+    {
+        m_format = qFromLittleEndian<quint16>(m_map + 10);
+
+        // Entries indexed in place, the last one for an ID wins
+        qint64 pos = Sda04Archive::HEADER_SIZE;
+        while(pos + Sda04Archive::TRAILER_SIZE <= size)
+        {
+            quint32 userID = qFromLittleEndian<quint32>(m_map + pos);
+
+            if(userID == Sda04Archive::END_MARK) {
+                complete = (pos + Sda04Archive::TRAILER_SIZE == size) && qFromLittleEndian<quint32>(m_map + pos + 4) == parsed;
+                break;
+            }
+
+            if(pos + Sda04Archive::ENTRY_HEADER_SIZE > size)
+                break;
+
+            qint64 end = pos + Sda04Archive::ENTRY_HEADER_SIZE + qFromLittleEndian<quint32>(m_map + pos + 4);
+            if(end > size)
+                break;
+
+            m_entries.insert(userID, m_map + pos);
+            parsed++;
+            pos = end;
+        }
+    }
+
+    if(!complete)
+    {
+        qCritical() << "Invalid or truncated archive " << m_file.fileName();
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void Sda04ArchiveReader::close()
+{
+    m_entries.clear();
+
+    if(m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+
+    m_file.close();
+}
+
+QList<int> Sda04ArchiveReader::ids() const
+{
+    QList<int> list = m_entries.keys();
+    qSort(list);
+    return list;
+}
+
+QByteArray Sda04ArchiveReader::templates(int userID) const
+{
+    const uchar *entry = m_entries.value(userID);
+    if(!entry)
+        return QByteArray();
+
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(entry) + Sda04Archive::ENTRY_HEADER_SIZE, qFromLittleEndian<quint32>(entry + 4));
+}
+
+QByteArray Sda04ArchiveReader::directory(int userID) const
+{
+    const uchar *entry = m_entries.value(userID);
+    if(!entry)
+        return QByteArray();
+
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(entry) + 12, Sda04Archive::DIRECTORY_SIZE);
+}
+
+quint32 Sda04ArchiveReader::checksum(int userID) const
+{
+    const uchar *entry = m_entries.value(userID);
+
+    return entry? qFromLittleEndian<quint32>(entry + 8) : 0;
+}
+
+bool Sda04ArchiveReader::verify(int userID) const
+{
+    QByteArray data = templates(userID);
+
+    return !data.isEmpty() && Sda04TemplateStore::digest(data.constData(), data.size()) == checksum(userID);
+}
@@ -0,0 +1,75 @@
+#ifndef SDA04ARCHIVE_H
+#define SDA04ARCHIVE_H
+
+#include <QFile>
+#include <QSaveFile>
+#include <QHash>
+#include <QList>
+
+// Binary backup of a reader database, little endian :
+//   header : magic, version, template format
+//   entries : user ID, templates size, CRC-32 of the templates, 12 bytes 0x7d directory entry, templates
+//   trailer : END_MARK, number of entries (a file without it was cut short)
+// Entries are appended as they arrive from the reader, in any ID order.
+class Sda04Archive
+{
+public:
+    enum {
+        HEADER_SIZE = 16,
+        ENTRY_HEADER_SIZE = 24, // user ID, size, CRC, directory entry
+        DIRECTORY_SIZE = 12,
+        TRAILER_SIZE = 8,
+        VERSION = 1
+    };
+
+    static const quint32 END_MARK = 0xFFFFFFFF;
+};
+
+class Sda04ArchiveWriter
+{
+public:
+    explicit Sda04ArchiveWriter(const QString &fileName);
+
+    bool open(int format);
+    bool write(int userID, const char *directory, const QByteArray &templates);
+    // Trailer written and the file replaced at once, the previous archive stays intact until then
+    bool commit();
+    int count() const { return m_count; }
+
+private:
+    QSaveFile m_file;
+    int m_count;
+    bool m_failed;
+};
+
+// Memory mapped archive : templates are views on the file, checked against their CRC on demand
+class Sda04ArchiveReader
+{
+public:
+    explicit Sda04ArchiveReader(const QString &fileName);
+    ~Sda04ArchiveReader();
+
+    // Complete archive only (trailer found and matching)
+    bool open();
+    void close();
+    bool isOpen() const { return m_map != 0; }
+
+    int format() const { return m_format; }
+    int count() const { return m_entries.size(); }
+    QList<int> ids() const;
+    bool contains(int userID) const { return m_entries.contains(userID); }
+
+    // Valid while the reader is open
+    QByteArray templates(int userID) const;
+    QByteArray directory(int userID) const;
+    quint32 checksum(int userID) const;
+    bool verify(int userID) const;
+
+private:
+    QFile m_file;
+    uchar *m_map;
+    int m_format;
+    QHash<int, const uchar *> m_entries;
+};
+
+#endif // SDA04ARCHIVE_H
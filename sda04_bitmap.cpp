@@ -0,0 +1,180 @@
+#include "sda04_bitmap.h"
+#include <QImage>
+#include <QImageWriter>
+#include <QBuffer>
+
+#define SDA04_GRAY(i) (char)(i), (char)(i), (char)(i), 0x00
+#define SDA04_GRAY4(i) SDA04_GRAY(i), SDA04_GRAY(i + 1), SDA04_GRAY(i + 2), SDA04_GRAY(i + 3)
+#define SDA04_GRAY16(i) SDA04_GRAY4(i), SDA04_GRAY4(i + 4), SDA04_GRAY4(i + 8), SDA04_GRAY4(i + 12)
+#define SDA04_GRAY_PALETTE \
+    SDA04_GRAY16(0x00), SDA04_GRAY16(0x10), SDA04_GRAY16(0x20), SDA04_GRAY16(0x30), \
+    SDA04_GRAY16(0x40), SDA04_GRAY16(0x50), SDA04_GRAY16(0x60), SDA04_GRAY16(0x70), \
+    SDA04_GRAY16(0x80), SDA04_GRAY16(0x90), SDA04_GRAY16(0xA0), SDA04_GRAY16(0xB0), \
+    SDA04_GRAY16(0xC0), SDA04_GRAY16(0xD0), SDA04_GRAY16(0xE0), SDA04_GRAY16(0xF0)
+
+// 260 x 300, 78000 bytes of pixels
+static const char HEADER_FULL_SIZE[Sda04Bitmap::HEADER_SIZE] = {
+    0x42, 0x4d, (char)0xe6, 0x34, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x04, 0x00, 0x00,
+    0x28, 0x00, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x2c, 0x01, 0x00, 0x00, 0x01, 0x00, 0x08, 0x00,
+    0x00, 0x00, 0x00, 0x00, (char)0xb0, 0x30, 0x01, 0x00, (char)0xc2, 0x1e, 0x00, 0x00, (char)0xc2, 0x1e, 0x00, 0x00,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    SDA04_GRAY_PALETTE
+};
+
+// 130 x 150, rows padded to 132 bytes
+static const char HEADER_HALF_SIZE[Sda04Bitmap::HEADER_SIZE] = {
+    0x42, 0x4d, (char)0x8e, 0x51, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x04, 0x00, 0x00,
+    0x28, 0x00, 0x00, 0x00, (char)0x82, 0x00, 0x00, 0x00, (char)0x96, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    SDA04_GRAY_PALETTE
+};
+
+const char *Sda04Bitmap::header(int imageSize)
+{
+    return imageSize == 0? HEADER_FULL_SIZE : HEADER_HALF_SIZE;
+}
+
+int Sda04Bitmap::width(int imageSize)
+{
+    return imageSize == 0? FULL_WIDTH : HALF_WIDTH;
+}
+
+int Sda04Bitmap::height(int imageSize)
+{
+    return imageSize == 0? FULL_HEIGHT : HALF_HEIGHT;
+}
+
+int Sda04Bitmap::stride(int imageSize)
+{
+    // BMP rows are 4 bytes aligned
+    return (width(imageSize) + 3) & ~3;
+}
+
+int Sda04Bitmap::rawSize(int imageSize)
+{
+    return width(imageSize) * height(imageSize);
+}
+
+int Sda04Bitmap::fileSize(int imageSize)
+{
+    return HEADER_SIZE + stride(imageSize) * height(imageSize);
+}
+
+bool Sda04Bitmap::fromRaw(QByteArray &bitmap, int imageSize)
+{
+    if(bitmap.size() != HEADER_SIZE + rawSize(imageSize))
+        return false;
+
+    // The full size capture is sent as it is stored
+    if(imageSize == 0)
+        return true;
+
+    const int w = width(imageSize);
+    const int h = height(imageSize);
+    const int s = stride(imageSize);
+
+    bitmap.resize(fileSize(imageSize));
+    char *pixels = bitmap.data() + HEADER_SIZE;
+
+    // Rows spread to their padded position, last one first so none is overwritten
+    for(int row = h - 1; row > 0; row--)
+    {
+        memmove(pixels + row * s, pixels + row * w, w);
+        memset(pixels + row * s + w, 0, s - w);
+    }
+    memset(pixels + w, 0, s - w);
+
+    // Then swapped top to bottom
+    char line[HALF_WIDTH];
+    for(int top = 0, bottom = h - 1; top < bottom; top++, bottom--)
+    {
+        memcpy(line, pixels + top * s, w);
+        memcpy(pixels + top * s, pixels + bottom * s, w);
+        memcpy(pixels + bottom * s, line, w);
+    }
+
+    return true;
+}
+
+void Sda04Bitmap::copyRaw(QImage &image, int imageSize, const char *data, qint64 offset, qint64 size)
+{
+    const int w = width(imageSize);
+    const int h = height(imageSize);
+
+    // Rows may be split between two reads
+    while(size > 0 && offset < (qint64)w * h)
+    {
+        int row = offset / w;
+        int column = offset % w;
+        int n = qMin<qint64>(size, w - column);
+
+        // The full size capture comes bottom up, like the BMP it's stored as
+        if(imageSize == 0)
+            row = h - 1 - row;
+
+        memcpy(image.scanLine(row) + column, data, n);
+
+        data += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+QByteArray Sda04Bitmap::encode(const QImage &image, const char *format)
+{
+    QByteArray file;
+    QBuffer buffer(&file);
+    buffer.open(QIODevice::WriteOnly);
+
+    QImageWriter writer(&buffer, format);
+    if(!writer.write(image))
+        return QByteArray();
+
+    return file;
+}
+
+QByteArray Sda04BitmapPool::acquire(int imageSize)
+{
+    imageSize = (imageSize == 0)? 0 : 1;
+
+    QMutexLocker locker(&lock);
+
+    if(!free[imageSize].isEmpty())
+        return free[imageSize].takeLast();
+
+    locker.unlock();
+
+    QByteArray bitmap;
+    bitmap.reserve(Sda04Bitmap::fileSize(imageSize));
+    bitmap.append(Sda04Bitmap::header(imageSize), Sda04Bitmap::HEADER_SIZE);
+
+    return bitmap;
+}
+
+void Sda04BitmapPool::release(QByteArray &bitmap)
+{
+    // Only a buffer with its header intact can be reused
+    int imageSize = -1;
+    for(int size = 0; size < 2 && imageSize < 0; size++)
+    {
+        if(bitmap.size() >= Sda04Bitmap::HEADER_SIZE && bitmap.capacity() >= Sda04Bitmap::fileSize(size)
+                && memcmp(bitmap.constData(), Sda04Bitmap::header(size), Sda04Bitmap::HEADER_SIZE) == 0)
+            imageSize = size;
+    }
+
+    if(imageSize < 0)
+    {
+        bitmap.clear();
+        return;
+    }
+
+    bitmap.resize(Sda04Bitmap::HEADER_SIZE);
+
+    QMutexLocker locker(&lock);
+
+    if(free[imageSize].size() < MAX_FREE)
+        free[imageSize].append(bitmap);
+
+    bitmap = QByteArray();
+}
@@ -0,0 +1,59 @@
+#ifndef SDA04BITMAP_H
+#define SDA04BITMAP_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+class QImage;
+
+// 8 bits grayscale BMP of a reader capture. The header is a constant table, the pixels are
+// received right after it in a buffer sized for the whole file.
+class Sda04Bitmap
+{
+public:
+    enum {
+        HEADER_SIZE = 1078, // file and info headers, 256 entries gray palette
+        FULL_WIDTH = 260,
+        FULL_HEIGHT = 300,
+        HALF_WIDTH = 130,
+        HALF_HEIGHT = 150
+    };
+
+    // imageSize : SecugenSda04::IMAGE_FULL_SIZE or SecugenSda04::IMAGE_HALF_SIZE
+    static const char *header(int imageSize);
+    static int width(int imageSize);
+    static int height(int imageSize);
+    static int stride(int imageSize);
+    static int rawSize(int imageSize);
+    static int fileSize(int imageSize);
+
+    // Turns the raw rows received after the header into BMP rows (padded, bottom-up), in place
+    static bool fromRaw(QByteArray &bitmap, int imageSize);
+
+    // Streamed capture : raw bytes received at offset placed in a top down grayscale image of the size
+    static void copyRaw(QImage &image, int imageSize, const char *data, qint64 offset, qint64 size);
+    // Compressed file of an image (QImageWriter format, e.g. "png"), empty on failure
+    static QByteArray encode(const QImage &image, const char *format);
+};
+
+// Recycled capture buffers, already holding their header
+class Sda04BitmapPool
+{
+public:
+    enum {
+        MAX_FREE = 2 // kept per image size
+    };
+
+    // Header written, room reserved for the whole file
+    QByteArray acquire(int imageSize);
+
+    // Gives a bitmap back once the caller is done with it
+    void release(QByteArray &bitmap);
+
+private:
+    QMutex lock;
+    QList<QByteArray> free[2];
+};
+
+#endif // SDA04BITMAP_H
@@ -0,0 +1,337 @@
+#include "sda04_emulator.h"
+#include "sda04_engine.h"
+#include "sda04_template.h"
+#include "sda04_templatestore.h"
+#include <QThread>
+#include <QtEndian>
+#include <QDebug>
+
+Sda04Emulator::Sda04Emulator(quint32 seed, QObject *parent) : QObject(parent),
+    terminal(this), pacer(this), baudRate(9600), pacing(true),
+    identifyUser(0), captureDelay(0), dropRate(0), corruptRate(0), random(seed)
+{
+    pacer.setInterval(5);
+    connect(&pacer, &QTimer::timeout, this, &Sda04Emulator::sendPending);
+    connect(&terminal, &Sda04PseudoTerminal::readyRead, this, &Sda04Emulator::readCommand);
+}
+
+Sda04Emulator::~Sda04Emulator()
+{
+    stop();
+}
+
+bool Sda04Emulator::start()
+{
+    if(terminal.isOpen())
+        return true;
+
+    if(!terminal.open())
+        return false;
+
+    qDebug() << "SDA04 emulator on " << terminal.portName();
+
+    return true;
+}
+
+void Sda04Emulator::stop()
+{
+    pacer.stop();
+    terminal.close();
+}
+
+QString Sda04Emulator::portName() const
+{
+    return terminal.portName();
+}
+
+void Sda04Emulator::setBaudRate(qint32 baudRate)
+{
+    this->baudRate = baudRate;
+}
+
+void Sda04Emulator::setPacing(bool enabled)
+{
+    pacing = enabled;
+}
+
+void Sda04Emulator::populate(int count)
+{
+    users.clear();
+
+    for(int userID = 1; userID <= qMin(count, 9999); userID++)
+    {
+        QByteArray t = syntheticTemplate(userID);
+        users.insert(userID, t + t);
+    }
+}
+
+int Sda04Emulator::count() const
+{
+    return users.size();
+}
+
+void Sda04Emulator::setIdentifyUser(int userID)
+{
+    identifyUser = userID;
+}
+
+void Sda04Emulator::setCaptureDelay(int msecs)
+{
+    captureDelay = msecs;
+}
+
+void Sda04Emulator::setDropRate(double rate)
+{
+    dropRate = rate;
+}
+
+void Sda04Emulator::setCorruptRate(double rate)
+{
+    corruptRate = rate;
+}
+
+QByteArray Sda04Emulator::syntheticTemplate(int userID)
+{
+    // One finger view, minutiae spread from the user ID
+    const int minutiae = 30;
+    const int length = 26 + 4 + minutiae * 6 + 2;
+    QByteArray t(length, 0x00);
+    uchar *p = reinterpret_cast<uchar*>(t.data());
+
+    memcpy(p, "FMR\0 20\0", 8);
+    qToBigEndian<quint16>(length, p + 8);
+    qToBigEndian<quint16>(260, p + 16);
+    qToBigEndian<quint16>(300, p + 18);
+    qToBigEndian<quint16>(197, p + 20);
+    qToBigEndian<quint16>(197, p + 22);
+    p[24] = 1;
+    p[26] = 1;
+    p[28] = 80;
+    p[29] = minutiae;
+
+    quint32 seed = userID * 2654435761u;
+    for(int i = 0; i < minutiae; i++)
+    {
+        uchar *m = p + 30 + i * 6;
+        seed = seed * 1103515245 + 12345;
+        int x = 10 + (seed >> 8) % 240;
+        seed = seed * 1103515245 + 12345;
+        int y = 10 + (seed >> 8) % 280;
+        seed = seed * 1103515245 + 12345;
+
+        m[0] = (1 + (seed & 1)) << 6 | (x >> 8);
+        m[1] = x & 0xFF;
+        m[2] = y >> 8;
+        m[3] = y & 0xFF;
+        m[4] = (seed >> 8) % 180;
+        m[5] = 60;
+    }
+
+    return t;
+}
+
+void Sda04Emulator::readCommand()
+{
+    terminal.read(input);
+
+    // Command packet, then the extra data it announces
+    while(input.size() >= 12)
+    {
+        Sda04Ack header(input.constData());
+        quint32 extra = header.packetSize();
+
+        if((quint32)input.size() < 12 + extra)
+            break;
+
+        QByteArray frame = input.left(12);
+        QByteArray data = input.mid(12, extra);
+        input.remove(0, 12 + extra);
+
+        execute(frame, data);
+    }
+}
+
+void Sda04Emulator::execute(const QByteArray &frame, const QByteArray &data)
+{
+    Sda04Ack command(frame);
+    const char cmd = command.command();
+    const int userID = command.userId();
+
+    uint cks = 0;
+    for(int i = 1; i < 10; i++)
+        cks += (uchar)frame.at(i);
+
+    if(chance(dropRate))
+        return;
+
+    if((cks & 0xFF) != (uchar)frame.at(11)) {
+        answer(cmd, 0, 0, 0x28);
+        return;
+    }
+
+    switch(cmd)
+    {
+    case 0x21:
+        // No ACK : the new speed applies at once
+        if(Sda04Engine::baudRateFromCode(command.param1() & 0xFF) > 0)
+            baudRate = Sda04Engine::baudRateFromCode(command.param1() & 0xFF);
+        break;
+
+    case 0x30:
+        answer(cmd, command.param1(), 0, 0x00);
+        break;
+
+    case 0x56:
+        QThread::msleep(captureDelay);
+        if(users.contains(identifyUser))
+            answer(cmd, Sda04Command::toBcd(identifyUser), 0, 0x00);
+        else
+            answer(cmd, 0, 0, 0x1B);
+        break;
+
+    case 0x55:
+        QThread::msleep(captureDelay);
+        answer(cmd, command.param1(), 0, (users.contains(userID) && userID == identifyUser)? 0x00 : 0x04);
+        break;
+
+    case 0x43:
+    {
+        QThread::msleep(captureDelay);
+        bool full = (command.param1() == 0x0001);
+        QByteArray image(full? 260 * 300 : 130 * 150, 0x00);
+        for(int i = 0; i < image.size(); i++)
+            image[i] = (char)(i % 251);
+        answer(cmd, command.param1(), 0, 0x00, image);
+        break;
+    }
+
+    case 0x7d:
+    {
+        if(users.isEmpty()) {
+            answer(cmd, 0, 0, 0x0B);
+            break;
+        }
+
+        // 12 bytes per user, the BCD ID first
+        QByteArray list(users.size() * 12, 0x00);
+        int i = 0;
+        foreach(int id, users.keys())
+        {
+            quint16 bcd = Sda04Command::toBcd(id);
+            list[i * 12] = bcd & 0xFF;
+            list[i * 12 + 1] = bcd >> 8;
+            i++;
+        }
+        answer(cmd, users.size(), 0, 0x00, list);
+        break;
+    }
+
+    case 0x71:
+    {
+        // The record size tells the format : ANSI378 (two 800 bytes slots) or SG400 (one)
+        const int format = (data.size() == Sda04TemplateStore::recordSize(Sda04Template::FORMAT_ANSI378))?
+            Sda04Template::FORMAT_ANSI378 : Sda04Template::FORMAT_SG400;
+
+        if((quint32)data.size() != command.packetSize() || data.size() != Sda04TemplateStore::recordSize(format)) {
+            answer(cmd, 0, 0, 0x11);
+            break;
+        }
+
+        int id = Sda04Ack::fromBcd((uchar)data.at(0) | ((uchar)data.at(1) << 8));
+        QByteArray templates;
+
+        if(format == Sda04Template::FORMAT_ANSI378)
+        {
+            Sda04Template t1(data.constData() + 4, 800, format);
+            Sda04Template t2(data.constData() + 804, 800, format);
+
+            if(t1.isValid() && t2.isValid())
+                templates = QByteArray(t1.data(), t1.length()) + QByteArray(t2.data(), t2.length());
+        } else {
+            // SG400 is opaque : kept as sent
+            templates = data.mid(4, 800);
+        }
+
+        if(templates.isEmpty())
+            answer(cmd, 0, 0, 0x30);
+        else if(users.contains(id) && command.param1() == 0)
+            answer(cmd, 0, 0, 0x05);
+        else {
+            users.insert(id, templates);
+            answer(cmd, 0, 0, 0x00);
+        }
+        break;
+    }
+
+    case 0x73:
+        if(users.contains(userID))
+            answer(cmd, command.param1(), 0, 0x00, users.value(userID));
+        else
+            answer(cmd, command.param1(), 0, 0x06);
+        break;
+
+    case 0x54:
+        answer(cmd, command.param1(), 0, users.remove(userID)? 0x00 : 0x06);
+        break;
+
+    case 0x50:
+        QThread::msleep(captureDelay);
+        answer(cmd, command.param1(), 0, users.contains(userID)? 0x05 : 0x00);
+        break;
+
+    case 0x51:
+        QThread::msleep(captureDelay);
+        users.insert(userID, syntheticTemplate(userID) + syntheticTemplate(userID));
+        answer(cmd, command.param1(), 0, 0x00);
+        break;
+
+    default:
+        answer(cmd, 0, 0, 0xFF);
+        break;
+    }
+}
+
+void Sda04Emulator::answer(char cmd, quint16 param1, quint16 param2, int error, const QByteArray &data)
+{
+    Sda04Command ack(cmd, param1, param2, error == 0x00? data.size() : 0);
+    QByteArray frame = ack.frame();
+
+    // ACK checksum covers bytes 0 to 10, error code included
+    frame[10] = (char)error;
+    uint cks = 0;
+    for(int i = 0; i < 11; i++)
+        cks += (uchar)frame.at(i);
+    frame[11] = (char)(chance(corruptRate)? ~cks : cks);
+
+    output.append(frame);
+    if(error == 0x00)
+        output.append(data);
+
+    if(pacing && baudRate > 0) {
+        if(!pacer.isActive())
+            pacer.start();
+    } else {
+        sendPending();
+    }
+}
+
+void Sda04Emulator::sendPending()
+{
+    // 10 bits per byte on the line
+    qint64 budget = (pacing && baudRate > 0)? qMax<qint64>(1, (qint64)baudRate / 10 * pacer.interval() / 1000) : output.size();
+    qint64 n = terminal.write(output.constData(), qMin<qint64>(budget, output.size()));
+
+    if(n > 0)
+        output.remove(0, n);
+
+    if(output.isEmpty())
+        pacer.stop();
+    else if(!pacer.isActive())
+        pacer.start();
+}
+
+bool Sda04Emulator::chance(double rate)
+{
+    // Raw 32 bits draws : the sequence of a seed doesn't depend on the standard library
+    return rate > 0 && random() < rate * 4294967296.0;
+}
@@ -0,0 +1,71 @@
+#ifndef SDA04EMULATOR_H
+#define SDA04EMULATOR_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QMap>
+#include <QTimer>
+#include <sda04_pseudoterminal.h>
+#include <random>
+
+// Software SDA04 on a pseudo terminal : SecugenSda04 opens portName() as it would open the reader.
+// Answers the commands of the driver with the same frames, paced at the serial speed, from an
+// in memory database. Errors can be injected to exercise timeouts and checksum failures, drawn from
+// the emulator's own generator : the same seed gives the same faults, whatever the other threads do.
+// Capture delays block : run it in its own thread, started and stopped there with QMetaObject::invokeMethod().
+class Sda04Emulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Sda04Emulator(quint32 seed = 1, QObject *parent = 0);
+    ~Sda04Emulator();
+
+    Q_INVOKABLE bool start();
+    Q_INVOKABLE void stop();
+    Q_INVOKABLE QString portName() const;
+
+    // Speed the answers are paced at (the reader starts at 9600), 0 : no pacing
+    void setBaudRate(qint32 baudRate);
+    void setPacing(bool enabled);
+
+    // Synthetic ANSI378 users 1 to count
+    void populate(int count);
+    int count() const;
+
+    // User found by identify (0x56), 0 : no match
+    void setIdentifyUser(int userID);
+    // Time to capture a finger (identify, verify, image, enrollment)
+    void setCaptureDelay(int msecs);
+
+    // Probability (0 - 1) that a command gets no answer or a corrupted ACK
+    void setDropRate(double rate);
+    void setCorruptRate(double rate);
+
+    static QByteArray syntheticTemplate(int userID);
+
+private slots:
+    void readCommand();
+    void sendPending();
+
+private:
+    Sda04PseudoTerminal terminal;
+    QTimer pacer;
+    QByteArray input;
+    QByteArray output;
+
+    qint32 baudRate;
+    bool pacing;
+    int identifyUser;
+    int captureDelay;
+    double dropRate;
+    double corruptRate;
+    QMap<int, QByteArray> users; // templates as returned by 0x73
+    std::mt19937 random; // fault injection
+
+    void execute(const QByteArray &frame, const QByteArray &data);
+    void answer(char cmd, quint16 param1, quint16 param2, int error, const QByteArray &data = QByteArray());
+    bool chance(double rate);
+};
+
+#endif // SDA04EMULATOR_H
@@ -0,0 +1,6 @@
+# Software readers on a POSIX pseudo terminal, for benchmarks and tests only : not part of the driver.
+# Include after fingerprint.pri.
+
+### SDA04 emulator and capture replay ###
+HEADERS                += $$PWD/sda04_pseudoterminal.h $$PWD/sda04_emulator.h $$PWD/sda04_replay.h
+SOURCES                += $$PWD/sda04_pseudoterminal.cpp $$PWD/sda04_emulator.cpp $$PWD/sda04_replay.cpp
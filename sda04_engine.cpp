@@ -0,0 +1,897 @@
+#include "sda04_engine.h"
+
+Sda04FrameParser::Sda04FrameParser()
+{
+    reset();
+}
+
+void Sda04FrameParser::reset()
+{
+    m_state = WaitingAck;
+    m_ackSize = 0;
+    m_payload.clear();
+    m_offset = 0;
+    m_expected = 0;
+    m_received = 0;
+    m_checkSumError = false;
+}
+
+void Sda04FrameParser::setPayloadBuffer(QByteArray &&buffer, int offset)
+{
+    // Moved in : the only reference, so resizing keeps the reserved capacity instead of detaching
+    m_payload = std::move(buffer);
+    buffer = QByteArray();
+    m_payload.resize(offset);
+    m_offset = offset;
+}
+
+QByteArray Sda04FrameParser::takePayload()
+{
+    // Only what was received, for a packet cut short
+    if(m_state == WaitingPayload)
+        m_payload.resize(m_offset + m_received);
+
+    QByteArray payload = std::move(m_payload);
+    m_payload = QByteArray();
+    return payload;
+}
+
+QByteArray Sda04FrameParser::takeBuffer()
+{
+    // Nothing of a packet cut short is kept
+    m_payload.resize(m_offset);
+
+    QByteArray buffer = std::move(m_payload);
+    m_payload = QByteArray();
+    return buffer;
+}
+
+qint64 Sda04FrameParser::feed(const char *data, qint64 size)
+{
+    qint64 consumed = 0;
+
+    while(consumed < size && space() > 0)
+    {
+        qint64 n = qMin<qint64>(space(), size - consumed);
+        memcpy(buffer(), data + consumed, n);
+        written(n);
+        consumed += n;
+    }
+
+    return consumed;
+}
+
+char *Sda04FrameParser::buffer()
+{
+    if(m_state == WaitingAck)
+        return m_ack + m_ackSize;
+    if(m_state == WaitingPayload)
+        return m_payload.data() + m_offset + m_received;
+
+    return 0;
+}
+
+qint64 Sda04FrameParser::space() const
+{
+    if(m_state == WaitingAck)
+        return 12 - m_ackSize;
+    if(m_state == WaitingPayload)
+        return m_expected - m_received;
+
+    return 0;
+}
+
+void Sda04FrameParser::written(qint64 size)
+{
+    if(m_state == WaitingPayload)
+    {
+        m_received += size;
+
+        if(m_received == m_expected)
+            m_state = Complete;
+        return;
+    }
+
+    if(m_state != WaitingAck)
+        return;
+
+    m_ackSize += size;
+    if(m_ackSize < 12)
+        return;
+
+    Sda04Ack ack(m_ack);
+    m_expected = ack.packetSize();
+    m_checkSumError = !ack.checkSumValid();
+
+    // A data packet only follows a valid and successful ACK
+    if(m_checkSumError || ack.error() != 0x00 || m_expected == 0) {
+        m_state = Complete;
+    } else {
+        // Sized once, exactly : a buffer with the capacity (reserved by its owner) isn't reallocated
+        m_state = WaitingPayload;
+        m_payload.resize(m_offset + m_expected);
+    }
+}
+
+Sda04Reply::Sda04Reply(Sda04Command command, int priority, QObject *parent) : QObject(parent),
+    m_command(std::move(command)), m_priority(priority), m_engine(0), m_finished(0), m_cancelled(0), m_rejected(false), m_autoDelete(false), m_timedOut(false), m_linkLost(false), m_error(-1)
+{
+    m_queued.start();
+}
+
+Sda04Reply::~Sda04Reply()
+{
+    // The engine may still be signalling the end of this reply
+    QMutexLocker locker(&m_lock);
+}
+
+bool Sda04Reply::waitForFinished(int msecs)
+{
+    if(isFinished())
+        return true;
+
+    if(!m_engine || QThread::currentThread() == m_engine->thread())
+    {
+        qWarning() << "waitForFinished() can't be called from the engine thread";
+        return false;
+    }
+
+    QMutexLocker locker(&m_lock);
+    QElapsedTimer waiting;
+    waiting.start();
+
+    while(!isFinished())
+    {
+        if(msecs < 0) {
+            m_condition.wait(&m_lock);
+        } else {
+            qint64 left = msecs - waiting.elapsed();
+            if(left <= 0 || !m_condition.wait(&m_lock, left))
+                return isFinished();
+        }
+    }
+
+    return true;
+}
+
+void Sda04Reply::onFinished(QObject *context, std::function<void ()> handler)
+{
+    // complete() marks and signals the reply under this lock : either connected in time or already finished
+    QMutexLocker locker(&m_lock);
+
+    if(isFinished())
+        QTimer::singleShot(0, context, handler);
+    else
+        connect(this, &Sda04Reply::finished, context, handler);
+}
+
+QByteArray Sda04Reply::takeBuffer()
+{
+    QByteArray buffer = std::move(m_command.packetBuffer);
+    m_command.packetBuffer = QByteArray();
+    return buffer;
+}
+
+QByteArray Sda04Reply::takePacket()
+{
+    QByteArray packet = std::move(m_packet);
+    m_packet = QByteArray();
+    return packet;
+}
+
+Sda04Engine::Sda04Engine(const QString &serialPort, QObject *parent) : QObject(parent),
+    serial(this), serialPort(serialPort), session(false), linkBaudRate(QSerialPort::Baud57600), linkReady(true), current(0), timer(this), reportedProgress(-1), resyncing(false), lost(false),
+    recorder(0), configuredAt(-1), writtenAt(-1), firstByteAt(-1), ackAt(-1), deadline(0)
+{
+    serial.setPortName(serialPort);
+    timer.setSingleShot(true);
+
+    ackTimeouts[CLASS_STATUS] = ACK_STATUS;
+    ackTimeouts[CLASS_DATABASE] = ACK_DATABASE;
+    ackTimeouts[CLASS_CAPTURE] = ACK_CAPTURE;
+
+    connect(&serial, &QSerialPort::readyRead, this, &Sda04Engine::readData);
+    connect(&serial, &QSerialPort::bytesWritten, this, &Sda04Engine::commandWritten);
+    connect(&timer, &QTimer::timeout, this, &Sda04Engine::commandTimeout);
+    connect(&serial, &QSerialPort::errorOccurred, this, &Sda04Engine::serialError);
+}
+
+Sda04Engine::~Sda04Engine()
+{
+    stopRecording();
+
+    if(current)
+    {
+        current->m_timedOut = true;
+        complete(current);
+        current = 0;
+    }
+
+    QMutexLocker locker(&queueLock);
+
+    for(int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        while(!queues[priority].isEmpty())
+        {
+            Sda04Reply *reply = queues[priority].dequeue();
+            reply->m_timedOut = true;
+            complete(reply);
+        }
+    }
+}
+
+Sda04Reply *Sda04Engine::submit(Sda04Command command, Sda04Reply::Decoder decoder, int priority, Setup setup)
+{
+    priority = qBound<int>(PRIORITY_INTERACTIVE, priority, PRIORITY_BULK);
+
+    Sda04Reply *reply = new Sda04Reply(std::move(command), priority);
+    reply->m_decoder = decoder;
+    reply->m_engine = this;
+
+    if(setup)
+        setup(reply);
+
+    enqueue(reply);
+
+    return reply;
+}
+
+void Sda04Engine::post(Sda04Command command, Sda04Reply::Decoder decoder, int priority, Setup setup)
+{
+    priority = qBound<int>(PRIORITY_INTERACTIVE, priority, PRIORITY_BULK);
+
+    Sda04Reply *reply = new Sda04Reply(std::move(command), priority);
+    reply->m_decoder = decoder;
+    reply->m_engine = this;
+    reply->m_autoDelete = true;
+
+    if(setup)
+        setup(reply);
+
+    enqueue(reply);
+}
+
+void Sda04Engine::enqueue(Sda04Reply *reply)
+{
+    queueLock.lock();
+    queues[reply->priority()].enqueue(reply);
+    queueLock.unlock();
+
+    // Started from the engine thread. A command ending there may start this one before the caller
+    // gets the reply back : finished() is only safe through Sda04Reply::onFinished()
+    QMetaObject::invokeMethod(this, "startNext", Qt::QueuedConnection);
+}
+
+Sda04Reply *Sda04Engine::reject(const Sda04Command &command, int error, Sda04Reply::Decoder decoder)
+{
+    Sda04Reply *reply = new Sda04Reply(command, PRIORITY_INTERACTIVE);
+    reply->m_decoder = decoder;
+    reply->m_engine = this;
+    reply->m_error = error;
+    reply->m_rejected = true;
+
+    // Still finished from the engine thread, like any other reply
+    enqueue(reply);
+
+    return reply;
+}
+
+void Sda04Engine::cancel(Sda04Reply *reply)
+{
+    if(reply->isFinished())
+        return;
+
+    // Dropped by startNext() if still queued, stopped by cancelCurrent() if running
+    reply->m_cancelled.storeRelease(1);
+    QMetaObject::invokeMethod(this, "cancelCurrent", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(this, "startNext", Qt::QueuedConnection);
+}
+
+Sda04Engine::QueueStats Sda04Engine::queueStats(int priority) const
+{
+    QMutexLocker locker(&queueLock);
+
+    if(priority < 0 || priority >= PRIORITY_COUNT)
+        return QueueStats();
+
+    QueueStats result = stats[priority];
+    result.depth = queues[priority].size();
+
+    return result;
+}
+
+void Sda04Engine::setSerialPort(qint32 baudRate)
+{
+    if(!serial.isOpen())
+    {
+        if (!serial.open(QIODevice::ReadWrite)) {
+            qCritical() << "error open : " << serial.errorString() << "(code : " << serial.error() << ")";
+        }
+
+        if (!serial.setBaudRate(baudRate)) {
+            qCritical() << "Can't set baud rate " << baudRate << " baud to port " << serialPort << ", error code " << serial.error();
+        }
+
+        if (!serial.setDataBits(QSerialPort::Data8)) {
+            qCritical() << "Can't set 8 data bits to port " << serialPort << ", error code " << serial.error();
+        }
+
+        if (!serial.setParity(QSerialPort::NoParity)) {
+            qCritical() << "Can't set no parity to port " << serialPort << ", error code " << serial.error();
+        }
+
+        if (!serial.setStopBits(QSerialPort::OneStop)) {
+            qCritical() << "Can't set 1 stop bit to port " << serialPort << ", error code " << serial.error();
+        }
+
+        if (!serial.setFlowControl(QSerialPort::NoFlowControl)) {
+            qCritical() << "Can't set no flow control to port " << serialPort << ", error code " << serial.error();
+        }
+
+    } else if (serial.baudRate() != baudRate) {
+
+        // Port already configured by the session : only the speed may change
+        if (!serial.setBaudRate(baudRate)) {
+            qCritical() << "Can't set baud rate " << baudRate << " baud to port " << serialPort << ", error code " << serial.error();
+        }
+    }
+
+    serial.clearError();
+
+    if(recorder)
+        recorder->recordSpeed(serial.baudRate());
+}
+
+bool Sda04Engine::startRecording(const QString &fileName)
+{
+    stopRecording();
+
+    recorder = new Sda04Recorder(fileName);
+
+    if(!recorder->open())
+    {
+        stopRecording();
+        return false;
+    }
+
+    if(serial.isOpen())
+        recorder->recordSpeed(serial.baudRate());
+
+    return true;
+}
+
+void Sda04Engine::stopRecording()
+{
+    delete recorder;
+    recorder = 0;
+}
+
+bool Sda04Engine::openSession(qint32 baudRate)
+{
+    session = true;
+
+    // 0 : keep the speed the reader is known to use
+    if(baudRate > 0)
+        linkBaudRate = baudRate;
+    setSerialPort(linkBaudRate);
+
+    return serial.isOpen();
+}
+
+void Sda04Engine::closeSession()
+{
+    session = false;
+
+    if(serial.isOpen() && !current)
+        serial.close();
+}
+
+bool Sda04Engine::reconnect()
+{
+    if(serial.isOpen())
+        serial.close();
+
+    setSerialPort(linkBaudRate);
+
+    return serial.isOpen();
+}
+
+bool Sda04Engine::isSessionOpen() const
+{
+    return session && serial.isOpen();
+}
+
+qint32 Sda04Engine::baudRate() const
+{
+    return linkBaudRate;
+}
+
+void Sda04Engine::setBaudRate(qint32 baudRate)
+{
+    // Speed the reader was found at : the next commands use it
+    linkBaudRate = baudRate;
+
+    if(serial.isOpen() && !current)
+        setSerialPort(linkBaudRate);
+}
+
+void Sda04Engine::startNext()
+{
+    if(current || resyncing)
+        return;
+
+    QList<Sda04Reply *> skipped;
+
+    // Highest class first : a bulk transfer gives way between two of its commands
+    queueLock.lock();
+
+    for(int priority = 0; priority < PRIORITY_COUNT && !current; priority++)
+    {
+        while(!queues[priority].isEmpty() && (queues[priority].head()->isCancelled() || queues[priority].head()->m_rejected))
+            skipped.append(queues[priority].dequeue());
+
+        // Until the link speed is known, only a command carrying its own speed can run
+        int index = 0;
+        while(!linkReady && index < queues[priority].size() && queues[priority].at(index)->command().baudRate <= 0)
+            index++;
+
+        if(index >= queues[priority].size())
+            continue;
+
+        current = queues[priority].takeAt(index);
+
+        qint64 wait = current->m_queued.elapsed();
+        stats[priority].completed++;
+        stats[priority].totalWait += wait;
+        stats[priority].maxWait = qMax(stats[priority].maxWait, wait);
+    }
+
+    queueLock.unlock();
+
+    foreach(Sda04Reply *reply, skipped)
+    {
+        if(reply->m_rejected && !reply->isCancelled() && reply->m_decoder)
+            reply->m_result = reply->m_decoder(reply);
+        complete(reply);
+    }
+
+    if(!current)
+        return;
+
+    commandClock.start();
+    parser.reset();
+    reportedProgress = -1;
+    configuredAt = writtenAt = firstByteAt = ackAt = -1;
+
+    if(!current->m_command.packetBuffer.isNull())
+    {
+        // Handed over to the parser : the command keeps no reference that would force a copy
+        parser.setPayloadBuffer(std::move(current->m_command.packetBuffer), current->m_command.packetOffset);
+    }
+
+    const Sda04Command &command = current->command();
+
+    // A command runs at the link speed unless it probes another one
+    setSerialPort(command.baudRate > 0? command.baudRate : linkBaudRate);
+    configuredAt = commandClock.nsecsElapsed();
+#ifdef QT_DEBUG
+    qDebug() << "Serial configured to" << QString::number(serial.baudRate()) << "bauds";
+#endif
+
+    if(!serial.isOpen())
+    {
+        // No answer can come from a port that can't be opened.
+        // Still gone after a loss : every command fails fast as lost, not as a plain timeout
+        current->m_timedOut = true;
+        current->m_linkLost = lost;
+        if(lost)
+            emit linkLost();
+        emit serialTimeout();
+        finishCurrent();
+        return;
+    }
+
+    lost = false;
+
+    // Drop what is left from a previous (timed out) frame
+    serial.clear(QSerialPort::Input);
+
+    const QByteArray frame = command.frame();
+    bool written = serial.write(frame) == 12;
+
+    if(written && !command.data.isEmpty())
+        written = serial.write(command.data) == command.data.size();
+
+    if(recorder)
+    {
+        recorder->record(Sda04Recorder::RECORD_WRITE, frame.constData(), frame.size());
+        recorder->record(Sda04Recorder::RECORD_WRITE, command.data.constData(), command.data.size());
+    }
+
+    if(!written)
+    {
+        // Nothing will answer : no point waiting for the deadline
+        qCritical() << "Can't write command to " << serialPort << ", error code " << serial.error();
+        lost = true;
+        current->m_timedOut = true;
+        current->m_linkLost = true;
+        emit serialTimeout();
+        finishCurrent();
+        return;
+    }
+
+    deadline = commandClock.elapsed() + ackTimeoutMs();
+    armTimer();
+}
+
+void Sda04Engine::readData()
+{
+    // Rest of a cancelled answer : dropped until the reader goes quiet
+    if(resyncing)
+    {
+        discardInput();
+        timer.start(RESYNC_QUIET);
+        return;
+    }
+
+    if(!current || parser.state() == Sda04FrameParser::Complete)
+    {
+        discardInput();
+        return;
+    }
+
+    if(firstByteAt < 0)
+        firstByteAt = commandClock.nsecsElapsed();
+
+    quint32 before = parser.receivedPayload();
+
+    // Read in place, the ACK then the data packet : no intermediate buffer
+    qint64 n;
+    while(parser.space() > 0 && (n = serial.read(parser.buffer(), parser.space())) > 0)
+    {
+        if(recorder)
+            recorder->record(Sda04Recorder::RECORD_READ, parser.buffer(), n);
+        parser.written(n);
+    }
+
+    quint32 received = parser.receivedPayload();
+
+    if(ackAt < 0 && parser.state() != Sda04FrameParser::WaitingAck)
+    {
+        ackAt = commandClock.nsecsElapsed();
+        // ACK in : the deadline now covers the announced data packet
+        deadline = commandClock.elapsed() + payloadTimeoutMs();
+    }
+
+    if(received > before)
+        payloadReceived(before, received);
+
+    armTimer();
+
+    if(parser.state() == Sda04FrameParser::Complete)
+        finishCurrent();
+}
+
+void Sda04Engine::discardInput()
+{
+    char sink[256];
+    qint64 n;
+
+    while((n = serial.read(sink, sizeof(sink))) > 0)
+    {
+        if(recorder)
+            recorder->record(Sda04Recorder::RECORD_READ, sink, n);
+    }
+}
+
+void Sda04Engine::commandWritten()
+{
+    if(!current || serial.bytesToWrite() > 0)
+        return;
+
+    if(writtenAt < 0)
+        writtenAt = commandClock.nsecsElapsed();
+
+    // The reader doesn't acknowledge a baud change : the command ends once the frame is on the wire,
+    // timed instead of drained so the thread never blocks. The next command (the probe) sets its own speed,
+    // the link speed only changes once that probe is answered (setBaudRate()).
+    if(current->command().cmd == 0x21)
+        timer.start(transferTime(12) * PAYLOAD_MARGIN);
+}
+
+void Sda04Engine::payloadReceived(quint32 before, quint32 received)
+{
+    const Sda04Command &command = current->command();
+    quint32 total = parser.expectedPayload();
+
+    if(before == 0)
+        transferClock.start();
+
+    if(command.chunkHandler)
+        command.chunkHandler(parser.payloadData() + before, before, received - before);
+
+    int percentage = (quint64)received * 100 / total;
+
+    if(percentage != reportedProgress)
+    {
+        reportedProgress = percentage;
+        qint64 elapsed = qMax<qint64>(1, transferClock.elapsed());
+        emit current->progress(received, total, (qint64)received * 1000 / elapsed);
+    }
+}
+
+void Sda04Engine::cancelCurrent()
+{
+    if(!current || !current->isCancelled())
+        return;
+
+    qDebug() << "Command" << QString::number(current->command().cmd, 16) << "cancelled";
+
+    timer.stop();
+
+    Sda04Reply *reply = current;
+    current = 0;
+    recordMetrics(reply);
+    complete(reply);
+
+    // The reader goes on sending : the next command waits for the line to be quiet
+    resyncing = true;
+    timer.start(RESYNC_QUIET);
+}
+
+void Sda04Engine::commandTimeout()
+{
+    if(resyncing)
+    {
+        resyncing = false;
+        serial.clear(QSerialPort::Input);
+        startNext();
+
+        if(!current && !session)
+            serial.close();
+        return;
+    }
+
+    if(!current)
+        return;
+
+    // Speed change sent, nothing to wait for
+    if(current->command().cmd == 0x21 && writtenAt >= 0)
+    {
+        finishCurrent();
+        return;
+    }
+
+    qCritical() << "serial timeout error";
+
+    current->m_timedOut = true;
+    emit serialTimeout();
+    finishCurrent();
+}
+
+void Sda04Engine::finishCurrent()
+{
+    timer.stop();
+
+    Sda04Reply *reply = current;
+    current = 0;
+
+    if(parser.state() != Sda04FrameParser::WaitingAck)
+    {
+        reply->m_ack = parser.ack();
+        // 0x28 : protocol checksum error
+        reply->m_error = parser.checkSumError()? 0x28 : Sda04Ack(reply->m_ack).error();
+    }
+
+    if(parser.state() == Sda04FrameParser::Complete)
+        reply->m_packet = parser.takePayload();
+    else
+        reply->m_command.packetBuffer = parser.takeBuffer();
+
+#ifdef QT_DEBUG
+    qDebug() << "Serial response :";
+    qDebug() << "ACK Error : " << reply->m_error;
+    qDebug() << "ACK Packet size : " << parser.expectedPayload();
+    qDebug() << "data received (size : " << reply->m_packet.size() << ")";
+    qDebug() << "Command" << QString::number(reply->command().cmd, 16) << "done in" << commandClock.elapsed() << "ms";
+#endif
+
+    recordMetrics(reply);
+
+    if(reply->m_error > 0)
+        emit deviceError(reply->m_error);
+
+    if(serial.error() == QSerialPort::ResourceError)
+    {
+        qCritical() << "serial link lost on " << serialPort;
+        lost = true;
+        serial.close();
+    }
+
+    queueLock.lock();
+    bool idle = true;
+    for(int priority = 0; priority < PRIORITY_COUNT; priority++)
+        idle = idle && queues[priority].isEmpty();
+    queueLock.unlock();
+
+    if(!session && idle)
+        serial.close();
+
+    if(reply->m_decoder)
+        reply->m_result = reply->m_decoder(reply);
+
+    complete(reply);
+
+    startNext();
+}
+
+void Sda04Engine::complete(Sda04Reply *reply)
+{
+    bool autoDelete;
+
+    {
+        // Held until the end : the reply can't be destroyed while it's signalled.
+        // Once released, a waiting caller may delete it : nothing is read from it past this scope
+        QMutexLocker locker(&reply->m_lock);
+
+        autoDelete = reply->m_autoDelete;
+        reply->m_finished.storeRelease(1);
+        emit reply->finished();
+        reply->m_condition.wakeAll();
+    }
+
+    // A posted command has no owner
+    if(autoDelete)
+        delete reply;
+}
+
+void Sda04Engine::recordMetrics(Sda04Reply *reply)
+{
+    qint64 phases[Sda04Metrics::PHASE_COUNT];
+    qint64 end = commandClock.nsecsElapsed();
+    // Write end unknown (no bytesWritten yet) : phases measured from the configuration
+    qint64 written = (writtenAt >= 0)? writtenAt : configuredAt;
+
+    phases[Sda04Metrics::PHASE_CONFIGURE] = configuredAt;
+    phases[Sda04Metrics::PHASE_WRITE] = (writtenAt >= 0 && configuredAt >= 0)? writtenAt - configuredAt : -1;
+    phases[Sda04Metrics::PHASE_FIRST_BYTE] = (firstByteAt >= 0 && written >= 0)? qMax<qint64>(0, firstByteAt - written) : -1;
+    phases[Sda04Metrics::PHASE_ACK] = (ackAt >= 0 && written >= 0)? qMax<qint64>(0, ackAt - written) : -1;
+    phases[Sda04Metrics::PHASE_PAYLOAD] = (ackAt >= 0 && parser.expectedPayload() > 0 && parser.state() == Sda04FrameParser::Complete)? end - ackAt : -1;
+    phases[Sda04Metrics::PHASE_TOTAL] = end;
+
+    commandMetrics.record(reply->command().cmd, phases, reply->m_error, reply->m_timedOut, reply->isCancelled());
+}
+
+void Sda04Engine::serialError(QSerialPort::SerialPortError error)
+{
+    if(error != QSerialPort::ResourceError)
+        return;
+
+    lost = true;
+
+    if(resyncing)
+        return;
+
+    // Failed at once rather than at the deadline, the caller can move to another reader
+    qCritical() << "serial link lost on " << serialPort;
+    emit linkLost();
+
+    if(!current)
+    {
+        serial.close();
+        return;
+    }
+
+    current->m_timedOut = true;
+    current->m_linkLost = true;
+    emit serialTimeout();
+    finishCurrent();
+}
+
+// Deadline of the current phase, or a data packet stall, whichever comes first
+void Sda04Engine::armTimer()
+{
+    qint64 remaining = qMax<qint64>(0, deadline - commandClock.elapsed());
+
+    if(parser.state() == Sda04FrameParser::WaitingPayload)
+        remaining = qMin<qint64>(remaining, PAYLOAD_GAP);
+
+    timer.start(remaining);
+}
+
+// ms from the write to the ACK : the frame and its data on the wire, then the reader's work
+int Sda04Engine::ackTimeoutMs() const
+{
+    const Sda04Command &command = current->command();
+    int answer = command.timeout > 0? command.timeout : ackTimeouts[commandClass(command.cmd)].load();
+
+    return transferTime(12 + command.data.size()) + answer;
+}
+
+int Sda04Engine::payloadTimeoutMs() const
+{
+    return PAYLOAD_MARGIN * transferTime(parser.expectedPayload()) + PAYLOAD_SLACK;
+}
+
+// ms to move size bytes at the port speed (10 bits a byte)
+int Sda04Engine::transferTime(qint64 size) const
+{
+    qint32 rate = serial.baudRate() > 0? serial.baudRate() : linkBaudRate;
+
+    return size * 10 * 1000 / rate + 1;
+}
+
+void Sda04Engine::setAckTimeout(int commandClass, int msecs)
+{
+    if(commandClass >= 0 && commandClass < CLASS_COUNT && msecs > 0)
+        ackTimeouts[commandClass] = msecs;
+}
+
+int Sda04Engine::ackTimeout(int commandClass) const
+{
+    if(commandClass < 0 || commandClass >= CLASS_COUNT)
+        return 0;
+
+    return ackTimeouts[commandClass].load();
+}
+
+int Sda04Engine::commandClass(char cmd)
+{
+    switch(cmd)
+    {
+    case 0x43: // get image
+    case 0x50: // register start
+    case 0x51: // register end
+    case 0x55: // verify
+    case 0x56: // identify
+        return CLASS_CAPTURE;
+    case 0x54: // delete user
+    case 0x71: // register user (template)
+    case 0x73: // get template
+    case 0x7d: // user ID list
+        return CLASS_DATABASE;
+    default:
+        return CLASS_STATUS;
+    }
+}
+
+void Sda04Engine::setLinkReady(bool ready)
+{
+    queueLock.lock();
+    linkReady = ready;
+    queueLock.unlock();
+
+    // Commands held back may run now
+    QMetaObject::invokeMethod(this, "startNext", Qt::QueuedConnection);
+}
+
+bool Sda04Engine::isLinkReady() const
+{
+    QMutexLocker locker(&queueLock);
+    return linkReady;
+}
+
+// Speeds accepted by command 0x21
+char Sda04Engine::baudRateCode(qint32 baudRate)
+{
+    switch(baudRate)
+    {
+    case QSerialPort::Baud9600: return 0x01;
+    case QSerialPort::Baud19200: return 0x02;
+    case QSerialPort::Baud57600: return 0x03;
+    case QSerialPort::Baud115200: return 0x04;
+    default: return 0x00;
+    }
+}
+
+qint32 Sda04Engine::baudRateFromCode(char code)
+{
+    switch(code)
+    {
+    case 0x01: return QSerialPort::Baud9600;
+    case 0x02: return QSerialPort::Baud19200;
+    case 0x03: return QSerialPort::Baud57600;
+    case 0x04: return QSerialPort::Baud115200;
+    default: return 0;
+    }
+}
@@ -0,0 +1,365 @@
+#ifndef SDA04ENGINE_H
+#define SDA04ENGINE_H
+
+#include <QtSerialPort/QtSerialPort>
+#include <sda04_metrics.h>
+#include <sda04_recorder.h>
+#include <functional>
+
+class Sda04Reply;
+class Sda04Engine;
+
+struct Sda04Command
+{
+    // Called from the engine thread with each part of the data packet as it arrives
+    typedef std::function<void (const char *data, qint64 offset, qint64 size)> ChunkHandler;
+
+    Sda04Command(char cmd = 0x00, quint16 param1 = 0x0000, quint16 param2 = 0x0000, quint32 extraData = 0, const QByteArray &data = QByteArray(), qint32 baudRate = 0) :
+        cmd(cmd), param1(param1), param2(param2), extraData(extraData), data(data), baudRate(baudRate), timeout(0), packetOffset(0)
+    {
+    }
+
+    // 12 bytes command packet : channel, command, param1, param2, extra data size, stub, checksum (little endian)
+    QByteArray frame() const
+    {
+        unsigned char buf[12];
+
+        buf[0] = 0x00;
+        buf[1] = cmd;
+        buf[2] = param1 & 0xFF;
+        buf[3] = param1 >> 8;
+        buf[4] = param2 & 0xFF;
+        buf[5] = param2 >> 8;
+        buf[6] = extraData & 0xFF;
+        buf[7] = (extraData >> 8) & 0xFF;
+        buf[8] = (extraData >> 16) & 0xFF;
+        buf[9] = extraData >> 24;
+        buf[10] = 0x00;
+
+        uint cks = 0;
+        for(int i = 1; i < 10; i++)
+            cks += buf[i];
+        buf[11] = cks & 0xFF;
+
+        return QByteArray(reinterpret_cast<char*>(buf), 12);
+    }
+
+    // User IDs travel as BCD (ID 1234 is sent as 0x1234)
+    static quint16 toBcd(int value)
+    {
+        quint16 result = 0;
+        for(int shift = 0; shift < 16 && value > 0; shift += 4, value /= 10)
+            result |= (value % 10) << shift;
+        return result;
+    }
+
+    char cmd;
+    quint16 param1;
+    quint16 param2;
+    quint32 extraData;
+    QByteArray data;
+    qint32 baudRate; // 0 : current link speed
+    int timeout; // ms for the ACK once the command is sent, 0 : default of its command class
+
+    // Optional buffer the data packet is appended to, after its first packetOffset bytes.
+    // Filled in place only if nothing else shares it : the engine moves it to its parser.
+    QByteArray packetBuffer;
+    int packetOffset;
+
+    ChunkHandler chunkHandler;
+};
+
+// View over a 12 bytes ACK packet : fields are decoded in place, nothing is copied or allocated
+class Sda04Ack
+{
+public:
+    Sda04Ack() : m_data(zero()) {}
+    explicit Sda04Ack(const char *data) : m_data(reinterpret_cast<const uchar*>(data)) {}
+    explicit Sda04Ack(const QByteArray &ack) : m_data(ack.size() >= 12 ? reinterpret_cast<const uchar*>(ack.constData()) : zero()) {}
+
+    bool isValid() const { return m_data != zero(); }
+    uchar command() const { return m_data[1]; }
+    quint16 param1() const { return m_data[2] | (m_data[3] << 8); }
+    quint16 param2() const { return m_data[4] | (m_data[5] << 8); }
+    quint32 packetSize() const { return m_data[6] | (m_data[7] << 8) | (m_data[8] << 16) | ((quint32)m_data[9] << 24); }
+    uchar error() const { return m_data[10]; }
+    uchar checkSum() const { return m_data[11]; }
+
+    // User IDs travel as BCD (ID 1234 is sent as 0x1234)
+    int userId() const { return fromBcd(param1()); }
+
+    bool checkSumValid() const
+    {
+        uint cks = 0;
+        for(int i = 0; i < 11; i++)
+            cks += m_data[i];
+        return (cks & 0xFF) == m_data[11];
+    }
+
+    static int fromBcd(quint16 value)
+    {
+        int result = 0;
+        for(int shift = 12; shift >= 0; shift -= 4)
+        {
+            int digit = (value >> shift) & 0x0F;
+            if(digit > 9)
+                return 0;
+            result = result * 10 + digit;
+        }
+        return result;
+    }
+
+private:
+    static const uchar *zero()
+    {
+        static const uchar empty[12] = {0};
+        return empty;
+    }
+
+    const uchar *m_data;
+};
+
+// Incremental parser : ACK (12 bytes) followed by the data packet announced in the ACK.
+// Bytes are read straight to their place : the ACK array, then a data packet buffer sized by the ACK.
+class Sda04FrameParser
+{
+public:
+    enum State {
+        WaitingAck,
+        WaitingPayload,
+        Complete
+    };
+
+    Sda04FrameParser();
+    void reset();
+    // Takes the buffer over, the caller keeps no reference
+    void setPayloadBuffer(QByteArray &&buffer, int offset);
+    qint64 feed(const char *data, qint64 size);
+
+    // Direct reads : up to space() bytes written at buffer(), then reported with written()
+    char *buffer();
+    qint64 space() const;
+    void written(qint64 size);
+
+    State state() const { return m_state; }
+    QByteArray ack() const { return QByteArray(m_ack, m_ackSize); }
+    QByteArray payload() const { return m_payload; }
+    QByteArray takePayload();
+    // Payload buffer of a packet that didn't complete, cut back to its offset
+    QByteArray takeBuffer();
+    quint32 expectedPayload() const { return m_expected; }
+    quint32 receivedPayload() const { return m_received; }
+    const char *payloadData() const { return m_payload.constData() + m_offset; }
+    bool checkSumError() const { return m_checkSumError; }
+
+private:
+    State m_state;
+    bool m_checkSumError;
+    char m_ack[12];
+    int m_ackSize;
+    QByteArray m_payload;
+    int m_offset;
+    quint32 m_expected;
+    quint32 m_received;
+};
+
+class Sda04Reply : public QObject
+{
+    Q_OBJECT
+
+public:
+    typedef std::function<QVariant (Sda04Reply *)> Decoder;
+
+    explicit Sda04Reply(Sda04Command command, int priority, QObject *parent = 0);
+    ~Sda04Reply();
+
+    const Sda04Command &command() const { return m_command; }
+    int priority() const { return m_priority; }
+    bool isFinished() const { return m_finished.loadAcquire(); }
+    bool timedOut() const { return m_timedOut; }
+    // Port gone (unplugged, closed by the driver) : worth retrying on another reader
+    bool linkLost() const { return m_linkLost; }
+    bool isCancelled() const { return m_cancelled.loadAcquire(); }
+    int error() const { return m_error; }
+    QByteArray ack() const { return m_ack; }
+    QByteArray packet() const { return m_packet; }
+    QVariant result() const { return m_result; }
+
+    // Moves the data packet out of the reply, so a decoder can work on it in place
+    QByteArray takePacket();
+    // Command's packetBuffer given back unfilled when no complete data packet came (timeout, cancel, rejected)
+    QByteArray takeBuffer();
+
+    // Blocks the calling thread (never the engine thread) until the reply is finished
+    bool waitForFinished(int msecs = -1);
+
+    // Thread safe. The handler runs in the context's thread once the reply is finished, queued at once if it
+    // already is : a reply may end before submit() returns, a plain connect() afterwards would miss it
+    void onFinished(QObject *context, std::function<void ()> handler);
+
+signals:
+    // Emitted from the engine thread : delete the reply with deleteLater()
+    void finished();
+
+    // Data packet reception, emitted when the percentage changes
+    void progress(qint64 received, qint64 total, qint64 bytesPerSecond);
+
+private:
+    friend class Sda04Engine;
+
+    Sda04Command m_command;
+    int m_priority;
+    Decoder m_decoder;
+    Sda04Engine *m_engine;
+    QAtomicInt m_finished;
+    QAtomicInt m_cancelled;
+    bool m_rejected;
+    bool m_autoDelete;
+    bool m_timedOut;
+    bool m_linkLost;
+    int m_error;
+    QByteArray m_ack;
+    QByteArray m_packet;
+    QVariant m_result;
+    QElapsedTimer m_queued;
+    QMutex m_lock;
+    QWaitCondition m_condition;
+};
+
+class Sda04Engine : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Scheduling classes, a pending command of a lower value always runs first
+    enum Priority {
+        PRIORITY_INTERACTIVE = 0, // identify, verify, status
+        PRIORITY_ENROLLMENT = 1, // capture and registration of a new user
+        PRIORITY_BULK = 2, // database sync and backup
+        PRIORITY_COUNT = 3
+    };
+
+    // Deadlines by kind of command : the reader answers at once, writes its flash, or waits for a finger
+    enum CommandClass {
+        CLASS_STATUS = 0,
+        CLASS_DATABASE = 1,
+        CLASS_CAPTURE = 2,
+        CLASS_COUNT = 3
+    };
+
+    struct QueueStats
+    {
+        QueueStats() : depth(0), completed(0), totalWait(0), maxWait(0) {}
+
+        int depth; // commands waiting
+        quint64 completed; // commands started since creation
+        qint64 totalWait; // ms spent queued by the started commands
+        qint64 maxWait; // ms
+    };
+
+    explicit Sda04Engine(const QString &serialPort, QObject *parent = 0);
+    ~Sda04Engine();
+
+    // Called on a new reply before it's queued, for connections that must not miss a signal
+    typedef std::function<void (Sda04Reply *)> Setup;
+
+    // Thread safe. The reply may start, and even finish, before this returns : use Sda04Reply::onFinished().
+    // Pass a command holding a packetBuffer with std::move(), a copy left with the caller makes the engine reallocate it.
+    Sda04Reply *submit(Sda04Command command, Sda04Reply::Decoder decoder = Sda04Reply::Decoder(), int priority = PRIORITY_INTERACTIVE, Setup setup = Setup());
+    // Fire and forget : the result only goes to the decoder, the engine deletes the reply
+    void post(Sda04Command command, Sda04Reply::Decoder decoder, int priority = PRIORITY_INTERACTIVE, Setup setup = Setup());
+    // A queued command is dropped, a running one stops and the link is resynchronised
+    void cancel(Sda04Reply *reply);
+    // Finishes with the error without reaching the reader (command refused by the host)
+    Sda04Reply *reject(const Sda04Command &command, int error, Sda04Reply::Decoder decoder = Sda04Reply::Decoder());
+    QueueStats queueStats(int priority) const;
+    const Sda04Metrics &metrics() const { return commandMetrics; }
+    void recordTouch(qint64 latency) { commandMetrics.recordTouch(latency); }
+
+    Q_INVOKABLE void setSerialPort(qint32 baudRate);
+    Q_INVOKABLE bool openSession(qint32 baudRate);
+    Q_INVOKABLE void closeSession();
+    Q_INVOKABLE bool reconnect();
+    Q_INVOKABLE bool isSessionOpen() const;
+    Q_INVOKABLE qint32 baudRate() const;
+    Q_INVOKABLE void setBaudRate(qint32 baudRate);
+    // Every byte written and read from now on goes to a Sda04Recorder capture
+    Q_INVOKABLE bool startRecording(const QString &fileName);
+    Q_INVOKABLE void stopRecording();
+
+    // Thread safe. While the link speed is unknown only commands with their own speed (probes) run,
+    // the others wait in their queue
+    void setLinkReady(bool ready);
+    bool isLinkReady() const;
+
+    // Thread safe. ms given to the reader to acknowledge a command of the class, sending time excluded
+    void setAckTimeout(int commandClass, int msecs);
+    int ackTimeout(int commandClass) const;
+    static int commandClass(char cmd);
+
+    static char baudRateCode(qint32 baudRate);
+    static qint32 baudRateFromCode(char code);
+
+signals:
+    void deviceError(int error);
+    void serialTimeout();
+    void linkLost();
+
+private slots:
+    void startNext();
+    void readData();
+    void commandWritten();
+    void commandTimeout();
+    void cancelCurrent();
+    void serialError(QSerialPort::SerialPortError error);
+
+private:
+    QSerialPort serial;
+    QString serialPort;
+    bool session;
+    qint32 linkBaudRate;
+    bool linkReady; // guarded by queueLock
+    QAtomicInt ackTimeouts[CLASS_COUNT];
+
+    mutable QMutex queueLock;
+    QQueue<Sda04Reply *> queues[PRIORITY_COUNT];
+    QueueStats stats[PRIORITY_COUNT];
+    Sda04Reply *current;
+    Sda04FrameParser parser;
+    QTimer timer;
+    QElapsedTimer commandClock;
+    QElapsedTimer transferClock;
+    int reportedProgress;
+    bool resyncing;
+    bool lost; // port gone, until it can be opened again
+    Sda04Metrics commandMetrics;
+    Sda04Recorder *recorder; // 0 : not recording
+    qint64 configuredAt; // ns on commandClock, -1 until reached
+    qint64 writtenAt;
+    qint64 firstByteAt;
+    qint64 ackAt;
+    qint64 deadline; // ms on commandClock
+
+    enum {
+        RESYNC_QUIET = 100, // ms of silence ending the rest of a cancelled answer
+        ACK_STATUS = 1000, // ms, default ACK timeouts by command class
+        ACK_DATABASE = 3000,
+        ACK_CAPTURE = 10000,
+        PAYLOAD_MARGIN = 2, // data packet deadline : its transfer time at the link speed, times the margin, plus the slack
+        PAYLOAD_SLACK = 200, // ms
+        PAYLOAD_GAP = 1000 // ms without a byte of the data packet : the reader stalled
+    };
+
+    void finishCurrent();
+    void payloadReceived(quint32 before, quint32 received);
+    void complete(Sda04Reply *reply);
+    void recordMetrics(Sda04Reply *reply);
+    void enqueue(Sda04Reply *reply);
+    void discardInput();
+    void armTimer();
+    int ackTimeoutMs() const;
+    int payloadTimeoutMs() const;
+    int transferTime(qint64 size) const;
+};
+
+#endif // SDA04ENGINE_H
@@ -0,0 +1,201 @@
+#include "sda04_enrollment.h"
+
+Sda04Enrollment::Sda04Enrollment(SecugenSda04 *reader, Sda04TemplateStore *store, QObject *parent) : QObject(parent),
+    m_reader(reader), m_store(store), m_stage(STAGE_IDLE), m_userID(0), m_reserved(false), m_error(0), m_capture(0), m_readback(0)
+{
+}
+
+Sda04Enrollment::~Sda04Enrollment()
+{
+    Sda04Reply *replies[] = { m_capture, m_readback };
+
+    // Their handlers go with this object : the replies are ended and deleted here
+    for(uint i = 0; i < sizeof(replies) / sizeof(replies[0]); i++)
+    {
+        if(!replies[i])
+            continue;
+
+        m_reader->cancel(replies[i]);
+        replies[i]->waitForFinished();
+        delete replies[i];
+    }
+
+    release();
+}
+
+bool Sda04Enrollment::start(int userID)
+{
+    // One enrollment at a time, a cancelled one ends first
+    if(m_capture || m_readback || (m_stage != STAGE_IDLE && m_stage != STAGE_DONE && m_stage != STAGE_FAILED))
+        return false;
+
+    release();
+    m_userID = userID;
+    m_error = 0;
+    m_templates.clear();
+
+    // The free IDs are only known once the index has been read from the reader
+    if(m_userID == 0 && !m_reader->isUserIndexLoaded())
+    {
+        setStage(STAGE_LOADING_IDS);
+        m_capture = watch(m_reader->getuserIDsAsync(), &Sda04Enrollment::idsLoaded);
+        return true;
+    }
+
+    firstTouch();
+
+    return true;
+}
+
+void Sda04Enrollment::cancel()
+{
+    if(m_capture)
+        m_reader->cancel(m_capture);
+    if(m_readback)
+        m_reader->cancel(m_readback);
+}
+
+void Sda04Enrollment::firstTouch()
+{
+    if(m_userID == 0)
+    {
+        m_userID = m_reader->reserveUserID();
+        m_reserved = true;
+
+        if(m_userID > Sda04UserIndex::MAX_USER_ID)
+        {
+            m_userID = 0;
+            m_reserved = false;
+            setStage(STAGE_FIRST_TOUCH);
+            fail(2); // database full, as registerNewUserStart()
+            return;
+        }
+    }
+
+    qDebug() << "Enrollment of user " << m_userID;
+
+    setStage(STAGE_FIRST_TOUCH);
+    m_capture = watch(m_reader->registerNewUserStartAsync(m_userID), &Sda04Enrollment::firstTouched);
+}
+
+void Sda04Enrollment::idsLoaded(Sda04Reply *reply)
+{
+    m_capture = 0;
+    bool cancelled = reply->isCancelled();
+    reply->deleteLater();
+
+    if(cancelled || !m_reader->isUserIndexLoaded())
+    {
+        fail(-1);
+        return;
+    }
+
+    firstTouch();
+}
+
+void Sda04Enrollment::firstTouched(Sda04Reply *reply)
+{
+    m_capture = 0;
+    int result = reply->result().isValid()? reply->result().toInt() : -1;
+    bool answered = !reply->timedOut() && !reply->isCancelled();
+    reply->deleteLater();
+
+    if(!answered || result != 0)
+    {
+        fail(answered? result : -1);
+        return;
+    }
+
+    setStage(STAGE_SECOND_TOUCH);
+    m_capture = watch(m_reader->registerNewUserEndAsync(m_userID), &Sda04Enrollment::secondTouched);
+
+    // Queued right behind the second capture : no host round trip between the two
+    m_readback = watch(m_reader->getTemplateAsync(m_userID, Sda04Engine::PRIORITY_ENROLLMENT), &Sda04Enrollment::readBack);
+}
+
+void Sda04Enrollment::secondTouched(Sda04Reply *reply)
+{
+    m_capture = 0;
+    int result = reply->result().isValid()? reply->result().toInt() : -1;
+    bool answered = !reply->timedOut() && !reply->isCancelled();
+    reply->deleteLater();
+
+    if(!answered || result != 0)
+    {
+        // The read back finds nothing to return
+        if(m_readback)
+            m_reader->cancel(m_readback);
+
+        fail(answered? result : -1);
+        return;
+    }
+
+    setStage(STAGE_READBACK);
+}
+
+void Sda04Enrollment::readBack(Sda04Reply *reply)
+{
+    m_readback = 0;
+    QByteArray templates = reply->result().toByteArray();
+    reply->deleteLater();
+
+    // Registration failed : already reported by secondTouched()
+    if(m_stage != STAGE_READBACK)
+        return;
+
+    if(templates.isEmpty())
+    {
+        fail(-1);
+        return;
+    }
+
+    if(m_store && !m_store->setTemplates(m_userID, templates))
+        qWarning() << "Enrollment : templates of user " << m_userID << " not stored";
+
+    m_templates = templates;
+    release();
+    setStage(STAGE_DONE);
+
+    emit enrolled(m_userID, m_templates);
+}
+
+void Sda04Enrollment::fail(int error)
+{
+    Stage stage = m_stage;
+
+    qWarning() << "Enrollment of user " << m_userID << " failed at stage " << stage << ", error " << error;
+
+    m_error = error;
+    release();
+    setStage(STAGE_FAILED);
+
+    emit failed(stage, error);
+}
+
+void Sda04Enrollment::release()
+{
+    // A registered ID is in the index now, a failed one is free again
+    if(m_reserved)
+        m_reader->releaseUserID(m_userID);
+
+    m_reserved = false;
+}
+
+void Sda04Enrollment::setStage(Stage stage)
+{
+    if(m_stage == stage)
+        return;
+
+    m_stage = stage;
+    emit stageChanged(stage);
+}
+
+Sda04Reply *Sda04Enrollment::watch(Sda04Reply *reply, void (Sda04Enrollment::*handler)(Sda04Reply *))
+{
+    // Handled in the thread of the session, even if the reply ended before this
+    reply->onFinished(this, [this, reply, handler]() {
+        (this->*handler)(reply);
+    });
+
+    return reply;
+}
@@ -0,0 +1,68 @@
+#ifndef SDA04ENROLLMENT_H
+#define SDA04ENROLLMENT_H
+
+#include <QObject>
+#include <secugen_sda04.h>
+
+// Two touch enrollment driven by the replies : 0x50, 0x51 then the template read back with 0x73.
+// Nothing blocks the caller, every stage is signalled, the read back is queued right behind the
+// second capture and the ID is reserved on the host while the reader works.
+class Sda04Enrollment : public QObject
+{
+    Q_OBJECT
+    Q_ENUMS(Stage)
+
+public:
+    enum Stage {
+        STAGE_IDLE = 0,
+        STAGE_LOADING_IDS, // user index read once from the reader before an ID can be chosen
+        STAGE_FIRST_TOUCH,
+        STAGE_SECOND_TOUCH,
+        STAGE_READBACK,
+        STAGE_DONE,
+        STAGE_FAILED
+    };
+
+    // The reader (and the store) must outlive the session
+    explicit Sda04Enrollment(SecugenSda04 *reader, Sda04TemplateStore *store = 0, QObject *parent = 0);
+    ~Sda04Enrollment();
+
+    // userID 0 : the lowest free ID, reserved until the session ends
+    bool start(int userID = 0);
+    void cancel();
+
+    Stage stage() const { return m_stage; }
+    int userID() const { return m_userID; }
+    // Reader error of the failed stage (registerNewUserStart() / registerNewUserEnd() codes), -1 : no answer
+    int error() const { return m_error; }
+    QByteArray templates() const { return m_templates; }
+
+signals:
+    void stageChanged(int stage);
+    // Templates as getTemplate(), already in the store if one was given
+    void enrolled(int userID, const QByteArray &templates);
+    void failed(int stage, int error);
+
+private:
+    SecugenSda04 *m_reader;
+    Sda04TemplateStore *m_store;
+    Stage m_stage;
+    int m_userID;
+    bool m_reserved;
+    int m_error;
+    QByteArray m_templates;
+    Sda04Reply *m_capture;
+    Sda04Reply *m_readback;
+
+    void setStage(Stage stage);
+    void firstTouch();
+    void idsLoaded(Sda04Reply *reply);
+    void firstTouched(Sda04Reply *reply);
+    void secondTouched(Sda04Reply *reply);
+    void readBack(Sda04Reply *reply);
+    void fail(int error);
+    void release();
+    Sda04Reply *watch(Sda04Reply *reply, void (Sda04Enrollment::*handler)(Sda04Reply *));
+};
+
+#endif // SDA04ENROLLMENT_H
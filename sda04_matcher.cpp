@@ -0,0 +1,296 @@
+#include "sda04_matcher.h"
+#include "sda04_templatestore.h"
+#include "sda04_template.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtEndian>
+#include <QThread>
+#include <QSet>
+#include <QHash>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+Sda04Matcher::Sda04Matcher()
+{
+}
+
+void Sda04Matcher::clear()
+{
+    x.clear();
+    y.clear();
+    angle.clear();
+    userIds.clear();
+    first.clear();
+    size.clear();
+}
+
+int Sda04Matcher::count() const
+{
+    return userIds.size();
+}
+
+int Sda04Matcher::users() const
+{
+    QSet<int> distinct;
+    foreach(int userID, userIds)
+        distinct.insert(userID);
+
+    return distinct.size();
+}
+
+int Sda04Matcher::add(int userID, const QByteArray &templates)
+{
+    const uchar *data = reinterpret_cast<const uchar*>(templates.constData());
+    int available = templates.size();
+    int added = 0;
+
+    while(available > 0)
+    {
+        int length = addTemplate(userID, data, available);
+        if(length <= 0)
+            break;
+
+        data += length;
+        available -= length;
+        added++;
+    }
+
+    return added;
+}
+
+int Sda04Matcher::add(const Sda04TemplateStore &store)
+{
+    int added = 0;
+
+    if(store.format() != 1)
+        return 0;
+
+    // Read in place from the mapped slots
+    foreach(int userID, store.ids())
+    {
+        const uchar *record = reinterpret_cast<const uchar*>(store.recordData(userID));
+
+        if(addTemplate(userID, record + 4, 800) > 0)
+            added++;
+        if(addTemplate(userID, record + 804, 800) > 0)
+            added++;
+    }
+
+    return added;
+}
+
+int Sda04Matcher::addTemplate(int userID, const uchar *data, int available)
+{
+    Sda04Template parsed(reinterpret_cast<const char*>(data), available, 1);
+
+    // Minutiae of the first finger view
+    Sda04FingerView view = parsed.view(0);
+    if(!view.isValid() || view.minutiaeCount() < MIN_PAIRED)
+        return -1;
+
+    userIds.append(userID);
+    first.append(x.size());
+    size.append(view.minutiaeCount());
+
+    for(int i = 0; i < view.minutiaeCount(); i++)
+    {
+        Sda04Minutia minutia = view.minutia(i);
+        x.append(minutia.x());
+        y.append(minutia.y());
+        angle.append(minutia.angle());
+    }
+
+    return parsed.length();
+}
+
+bool Sda04Matcher::prepare(const uchar *data, int length, Probe &probe)
+{
+    Sda04Template parsed(reinterpret_cast<const char*>(data), length, 1);
+    Sda04FingerView view = parsed.view(0);
+
+    if(!view.isValid() || view.minutiaeCount() < MIN_PAIRED)
+        return false;
+
+    const int minutiae = view.minutiaeCount();
+    probe.size = minutiae;
+    probe.angle.resize(minutiae);
+    probe.x.resize(ROT_BINS * minutiae);
+    probe.y.resize(ROT_BINS * minutiae);
+
+    double centerX = 0, centerY = 0;
+    for(int i = 0; i < minutiae; i++)
+    {
+        Sda04Minutia minutia = view.minutia(i);
+        probe.angle[i] = minutia.angle();
+        centerX += minutia.x();
+        centerY += minutia.y();
+    }
+    centerX /= minutiae;
+    centerY /= minutiae;
+
+    // Probe rotated once per bin, about its centroid, so votes only need a subtraction.
+    // ANSI378 : y grows downward and angles run counterclockwise, bin 0 is the probe as captured.
+    for(int r = 0; r < ROT_BINS; r++)
+    {
+        double theta = rotation(r) * 2.0 * M_PI / 180.0;
+        double c = std::cos(theta), s = std::sin(theta);
+
+        for(int i = 0; i < minutiae; i++)
+        {
+            Sda04Minutia minutia = view.minutia(i);
+            double dx = minutia.x() - centerX;
+            double dy = minutia.y() - centerY;
+            probe.x[r * minutiae + i] = qRound(centerX + c * dx + s * dy);
+            probe.y[r * minutiae + i] = qRound(centerY - s * dx + c * dy);
+        }
+    }
+
+    return true;
+}
+
+// Bins centered on multiples of ROT_STEP : a difference within half a step of 0 falls in bin 0
+int Sda04Matcher::rotationBin(int difference)
+{
+    return ((difference % 180 + 180 + ROT_STEP / 2) % 180) / ROT_STEP;
+}
+
+int Sda04Matcher::rotation(int bin)
+{
+    return bin * ROT_STEP;
+}
+
+int Sda04Matcher::score(const Probe &probe, int candidate, QVector<quint64> &votes) const
+{
+    const int n = probe.size;
+    const int m = size.at(candidate);
+    const int *cx = x.constData() + first.at(candidate);
+    const int *cy = y.constData() + first.at(candidate);
+    const int *ca = angle.constData() + first.at(candidate);
+
+    // Hough vote : every minutiae pair proposes a rotation and a translation
+    votes.resize(n * m);
+    quint64 *vote = votes.data();
+
+    for(int i = 0; i < n; i++)
+    {
+        for(int j = 0; j < m; j++)
+        {
+            int r = rotationBin(ca[j] - probe.angle[i]);
+            int tx = cx[j] - probe.x[r * n + i];
+            int ty = cy[j] - probe.y[r * n + i];
+            quint64 key = (r << 16) | (((tx >> SHIFT_BIN) & 0xFF) << 8) | ((ty >> SHIFT_BIN) & 0xFF);
+
+            *vote++ = (key << 32) | ((quint32)(tx + 0x8000) << 16) | (quint32)(ty + 0x8000);
+        }
+    }
+
+    std::sort(votes.begin(), votes.end());
+
+    // Most voted transform, translation averaged over its votes
+    int best = 0, bestStart = 0;
+    for(int start = 0, end = 0; start < votes.size(); start = end)
+    {
+        while(end < votes.size() && (votes.at(end) >> 32) == (votes.at(start) >> 32))
+            end++;
+        if(end - start > best) {
+            best = end - start;
+            bestStart = start;
+        }
+    }
+
+    if(best < MIN_PAIRED)
+        return 0;
+
+    int r = votes.at(bestStart) >> 48;
+    qint64 sumX = 0, sumY = 0;
+    for(int k = bestStart; k < bestStart + best; k++) {
+        sumX += (int)((votes.at(k) >> 16) & 0xFFFF) - 0x8000;
+        sumY += (int)(votes.at(k) & 0xFFFF) - 0x8000;
+    }
+    const int tx = sumX / best;
+    const int ty = sumY / best;
+    const int turn = rotation(r);
+    const int d2 = DIST_TOLERANCE * DIST_TOLERANCE;
+
+    // Probe minutiae with a candidate one close in position and direction.
+    // Branch free inner loop over the packed arrays : vectorised by the compiler.
+    int paired = 0;
+    for(int i = 0; i < n; i++)
+    {
+        const int px = probe.x[r * n + i] + tx;
+        const int py = probe.y[r * n + i] + ty;
+        const int pa = (probe.angle[i] + turn) % 180;
+        int hit = 0;
+
+        for(int j = 0; j < m; j++)
+        {
+            int dx = cx[j] - px;
+            int dy = cy[j] - py;
+            int da = qAbs(ca[j] - pa);
+            da = qMin(da, 180 - da);
+            hit |= (dx * dx + dy * dy <= d2) & (da <= ANGLE_TOLERANCE);
+        }
+
+        paired += hit;
+    }
+
+    if(paired < MIN_PAIRED)
+        return 0;
+
+    return paired * paired * 100 / (n * m);
+}
+
+QList<Sda04Matcher::Match> Sda04Matcher::identify(const QByteArray &probeTemplate, int threshold, int maxResults) const
+{
+    QList<Match> matches;
+    Probe probe;
+
+    if(!prepare(reinterpret_cast<const uchar*>(probeTemplate.constData()), probeTemplate.size(), probe))
+    {
+        qWarning() << "Invalid probe template";
+        return matches;
+    }
+
+    // One contiguous range of candidates per core
+    const int candidates = count();
+    const int jobs = qMax(1, qMin(QThread::idealThreadCount(), candidates / 64));
+    QList<QFuture<QVector<Match> > > futures;
+
+    for(int job = 0; job < jobs; job++)
+    {
+        const int begin = candidates * job / jobs;
+        const int end = candidates * (job + 1) / jobs;
+
+        futures.append(QtConcurrent::run([this, &probe, begin, end, threshold]() {
+            QVector<Match> found;
+            QVector<quint64> votes;
+
+            for(int candidate = begin; candidate < end; candidate++)
+            {
+                int s = score(probe, candidate, votes);
+                if(s >= threshold)
+                    found.append(Match(userIds.at(candidate), s));
+            }
+
+            return found;
+        }));
+    }
+
+    // Best template of each user
+    QHash<int, int> best;
+    for(int job = 0; job < futures.size(); job++)
+    {
+        futures[job].waitForFinished();
+        foreach(const Match &match, futures[job].result())
+            best[match.userID] = qMax(best.value(match.userID), match.score);
+    }
+
+    for(QHash<int, int>::const_iterator it = best.constBegin(); it != best.constEnd(); ++it)
+        matches.append(Match(it.key(), it.value()));
+
+    std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+        return a.score > b.score || (a.score == b.score && a.userID < b.userID);
+    });
+
+    return matches.mid(0, maxResults);
+}
@@ -0,0 +1,71 @@
+#ifndef SDA04MATCHER_H
+#define SDA04MATCHER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+
+class Sda04TemplateStore;
+
+// Host side 1:N identification over ANSI378 templates read from one or several readers.
+// Minutiae of every candidate are packed in flat arrays (x, y, angle), scored on all cores.
+// add() and identify() must not run at the same time.
+class Sda04Matcher
+{
+public:
+    struct Match
+    {
+        Match(int userID = 0, int score = 0) : userID(userID), score(score) {}
+
+        int userID;
+        int score; // 0 - 100
+    };
+
+    enum {
+        ROT_STEP = 3, // rotation bin, in ANSI angle units (2 degrees)
+        ROT_BINS = 180 / ROT_STEP,
+        SHIFT_BIN = 4, // translation bin : 16 pixels
+        DIST_TOLERANCE = 12, // pixels between paired minutiae
+        ANGLE_TOLERANCE = 10, // ANSI angle units
+        MIN_PAIRED = 4
+    };
+
+    Sda04Matcher();
+
+    void clear();
+    int count() const; // templates
+    int users() const;
+
+    // One or more ANSI378 records back to back, as read with getTemplate()
+    int add(int userID, const QByteArray &templates);
+    // Both template slots of every record in the store
+    int add(const Sda04TemplateStore &store);
+
+    // Best score per user, highest first
+    QList<Match> identify(const QByteArray &probe, int threshold = 30, int maxResults = 10) const;
+
+private:
+    struct Probe
+    {
+        int size;
+        QVector<int> angle;
+        QVector<int> x; // ROT_BINS rotations of the probe, size entries each
+        QVector<int> y;
+    };
+
+    QVector<int> x;
+    QVector<int> y;
+    QVector<int> angle;
+
+    QVector<int> userIds; // per template
+    QVector<int> first;
+    QVector<int> size;
+
+    int addTemplate(int userID, const uchar *data, int length);
+    int score(const Probe &probe, int candidate, QVector<quint64> &votes) const;
+    static bool prepare(const uchar *data, int length, Probe &probe);
+    static int rotationBin(int difference);
+    static int rotation(int bin);
+};
+
+#endif // SDA04MATCHER_H
@@ -0,0 +1,188 @@
+#include "sda04_metrics.h"
+#include <QStringList>
+#include <algorithm>
+
+qint64 Sda04Metrics::Histogram::bucketLimit(int bucket)
+{
+    return (qint64)FIRST_BUCKET_US << bucket;
+}
+
+qint64 Sda04Metrics::Histogram::percentile(double p) const
+{
+    if(count == 0)
+        return 0;
+
+    quint64 rank = qMax<quint64>(1, (quint64)(p * count + 0.5));
+    quint64 seen = 0;
+
+    for(int bucket = 0; bucket < BUCKETS - 1; bucket++)
+    {
+        seen += buckets[bucket];
+        if(seen >= rank)
+            return qMin(bucketLimit(bucket), max);
+    }
+
+    return max;
+}
+
+Sda04Metrics::Sda04Metrics()
+{
+}
+
+void Sda04Metrics::record(int cmd, const qint64 *phases, int error, bool timedOut, bool cancelled)
+{
+    QMutexLocker locker(&lock);
+    Command &command = byCommand[cmd & 0xFF];
+
+    command.count++;
+    if(timedOut)
+        command.timeouts++;
+    if(cancelled)
+        command.cancelled++;
+    if(error > 0)
+        errors[error]++;
+
+    for(int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        if(phases[phase] >= 0)
+            add(command.phases[phase], phases[phase]);
+    }
+}
+
+void Sda04Metrics::recordTouch(qint64 latency)
+{
+    QMutexLocker locker(&lock);
+    add(touch, latency);
+}
+
+void Sda04Metrics::add(Histogram &histogram, qint64 ns)
+{
+    qint64 us = ns / 1000;
+    int bucket = 0;
+
+    while(bucket < BUCKETS - 1 && us >= Histogram::bucketLimit(bucket))
+        bucket++;
+
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.sum += us;
+    histogram.max = qMax(histogram.max, us);
+}
+
+void Sda04Metrics::clear()
+{
+    QMutexLocker locker(&lock);
+    byCommand.clear();
+    errors.clear();
+    touch = Histogram();
+}
+
+QList<int> Sda04Metrics::commands() const
+{
+    QMutexLocker locker(&lock);
+    QList<int> list = byCommand.keys();
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+Sda04Metrics::Histogram Sda04Metrics::histogram(int cmd, Phase phase) const
+{
+    QMutexLocker locker(&lock);
+    return byCommand.value(cmd & 0xFF).phases[phase];
+}
+
+quint64 Sda04Metrics::count(int cmd) const
+{
+    QMutexLocker locker(&lock);
+    return byCommand.value(cmd & 0xFF).count;
+}
+
+quint64 Sda04Metrics::timeouts(int cmd) const
+{
+    QMutexLocker locker(&lock);
+    return byCommand.value(cmd & 0xFF).timeouts;
+}
+
+quint64 Sda04Metrics::cancelled(int cmd) const
+{
+    QMutexLocker locker(&lock);
+    return byCommand.value(cmd & 0xFF).cancelled;
+}
+
+quint64 Sda04Metrics::deviceErrors(int error) const
+{
+    QMutexLocker locker(&lock);
+    return errors.value(error);
+}
+
+Sda04Metrics::Histogram Sda04Metrics::touchToDecision() const
+{
+    QMutexLocker locker(&lock);
+    return touch;
+}
+
+QVariantMap Sda04Metrics::snapshot() const
+{
+    QMutexLocker locker(&lock);
+    QVariantMap commandsMap;
+    QVariantMap errorsMap;
+
+    for(QHash<int, Command>::const_iterator it = byCommand.constBegin(); it != byCommand.constEnd(); ++it)
+    {
+        QVariantMap command;
+        command["count"] = it.value().count;
+        command["timeouts"] = it.value().timeouts;
+        command["cancelled"] = it.value().cancelled;
+
+        for(int phase = 0; phase < PHASE_COUNT; phase++)
+        {
+            if(it.value().phases[phase].count > 0)
+                command[phaseName((Phase)phase)] = toVariant(it.value().phases[phase]);
+        }
+
+        commandsMap["0x" + QString("%1").arg(it.key(), 2, 16, QChar('0'))] = command;
+    }
+
+    for(QHash<int, quint64>::const_iterator it = errors.constBegin(); it != errors.constEnd(); ++it)
+        errorsMap["0x" + QString("%1").arg(it.key(), 2, 16, QChar('0'))] = it.value();
+
+    QVariantMap result;
+    result["commands"] = commandsMap;
+    result["errors"] = errorsMap;
+    result["bucket_us"] = (qint64)FIRST_BUCKET_US;
+    if(touch.count > 0)
+        result["touch_to_decision"] = toVariant(touch);
+
+    return result;
+}
+
+QVariantMap Sda04Metrics::toVariant(const Histogram &h)
+{
+    QVariantList buckets;
+    for(int bucket = 0; bucket < BUCKETS; bucket++)
+        buckets.append(h.buckets[bucket]);
+
+    QVariantMap histogram;
+    histogram["count"] = h.count;
+    histogram["mean_us"] = h.sum / (qint64)h.count;
+    histogram["p50_us"] = h.percentile(0.50);
+    histogram["p99_us"] = h.percentile(0.99);
+    histogram["max_us"] = h.max;
+    histogram["buckets"] = buckets;
+
+    return histogram;
+}
+
+const char *Sda04Metrics::phaseName(Phase phase)
+{
+    switch(phase)
+    {
+    case PHASE_CONFIGURE: return "configure";
+    case PHASE_WRITE: return "write";
+    case PHASE_FIRST_BYTE: return "first_byte";
+    case PHASE_ACK: return "ack";
+    case PHASE_PAYLOAD: return "payload";
+    case PHASE_TOTAL: return "total";
+    default: return "unknown";
+    }
+}
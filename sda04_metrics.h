@@ -0,0 +1,83 @@
+#ifndef SDA04METRICS_H
+#define SDA04METRICS_H
+
+#include <QHash>
+#include <QMutex>
+#include <QVariantMap>
+
+// Always on timings of the serial commands : one histogram per opcode and phase,
+// plus timeout, cancel and device error counters. Recorded once per command.
+class Sda04Metrics
+{
+public:
+    enum Phase {
+        PHASE_CONFIGURE = 0, // port open and setup
+        PHASE_WRITE, // frame and data handed to the UART
+        PHASE_FIRST_BYTE, // end of write to the first byte of the answer
+        PHASE_ACK, // end of write to the complete ACK
+        PHASE_PAYLOAD, // ACK to the end of the data packet
+        PHASE_TOTAL,
+        PHASE_COUNT
+    };
+
+    enum {
+        BUCKETS = 20, // bucket k : below 128 us << k (last one : everything above)
+        FIRST_BUCKET_US = 128
+    };
+
+    struct Histogram
+    {
+        Histogram() : count(0), sum(0), max(0) { memset(buckets, 0, sizeof(buckets)); }
+
+        quint64 count;
+        qint64 sum; // us
+        qint64 max; // us
+        quint32 buckets[BUCKETS];
+
+        // Upper bound of the bucket holding the percentile, in us
+        qint64 percentile(double p) const;
+        static qint64 bucketLimit(int bucket);
+    };
+
+    Sda04Metrics();
+
+    // phases : durations in ns, negative if the phase didn't happen
+    void record(int cmd, const qint64 *phases, int error, bool timedOut, bool cancelled);
+    // AutoOn edge to identification result, in ns
+    void recordTouch(qint64 latency);
+    void clear();
+
+    QList<int> commands() const;
+    Histogram histogram(int cmd, Phase phase) const;
+    quint64 count(int cmd) const;
+    quint64 timeouts(int cmd) const;
+    quint64 cancelled(int cmd) const;
+    quint64 deviceErrors(int error) const; // all commands
+    Histogram touchToDecision() const;
+
+    // Everything above, for export : { "commands": { "0x56": {...} }, "errors": { "0x08": n } }
+    QVariantMap snapshot() const;
+
+    static const char *phaseName(Phase phase);
+
+private:
+    struct Command
+    {
+        Command() : count(0), timeouts(0), cancelled(0) {}
+
+        quint64 count;
+        quint64 timeouts;
+        quint64 cancelled;
+        Histogram phases[PHASE_COUNT];
+    };
+
+    mutable QMutex lock;
+    QHash<int, Command> byCommand;
+    QHash<int, quint64> errors;
+    Histogram touch;
+
+    static void add(Histogram &histogram, qint64 ns);
+    static QVariantMap toVariant(const Histogram &histogram);
+};
+
+#endif // SDA04METRICS_H
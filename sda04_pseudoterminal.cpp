@@ -0,0 +1,96 @@
+#include "sda04_pseudoterminal.h"
+#include <QDebug>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+Sda04PseudoTerminal::Sda04PseudoTerminal(QObject *parent) : QObject(parent),
+    master(-1), slave(-1), notifier(0)
+{
+}
+
+Sda04PseudoTerminal::~Sda04PseudoTerminal()
+{
+    close();
+}
+
+bool Sda04PseudoTerminal::open()
+{
+    if(master >= 0)
+        return true;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        qCritical() << "Can't create a pseudo terminal";
+        close();
+        return false;
+    }
+
+    slaveName = QString::fromLatin1(ptsname(master));
+
+    // Kept open so the terminal survives the driver closing its port, raw like a UART
+    slave = ::open(ptsname(master), O_RDWR | O_NOCTTY);
+    if(slave >= 0)
+    {
+        struct termios tio;
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    notifier = new QSocketNotifier(master, QSocketNotifier::Read, this);
+    // activated() is overloaded from Qt 5.15 and both overloads end in a private tag, which no
+    // QOverload<>::of() can name : connected by signature instead
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(notifier, SIGNAL(activated(QSocketDescriptor,QSocketNotifier::Type)), this, SIGNAL(readyRead()));
+#else
+    connect(notifier, SIGNAL(activated(int)), this, SIGNAL(readyRead()));
+#endif
+
+    return true;
+}
+
+void Sda04PseudoTerminal::close()
+{
+    delete notifier;
+    notifier = 0;
+
+    if(slave >= 0)
+        ::close(slave);
+    if(master >= 0)
+        ::close(master);
+
+    slave = -1;
+    master = -1;
+}
+
+QString Sda04PseudoTerminal::portName() const
+{
+    return slaveName;
+}
+
+qint64 Sda04PseudoTerminal::read(QByteArray &buffer)
+{
+    char buf[4096];
+    ssize_t n;
+    qint64 total = 0;
+
+    while(master >= 0 && (n = ::read(master, buf, sizeof(buf))) > 0)
+    {
+        buffer.append(buf, n);
+        total += n;
+    }
+
+    return total;
+}
+
+qint64 Sda04PseudoTerminal::write(const char *data, qint64 size)
+{
+    if(master < 0)
+        return -1;
+
+    return ::write(master, data, size);
+}
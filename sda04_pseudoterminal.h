@@ -0,0 +1,38 @@
+#ifndef SDA04PSEUDOTERMINAL_H
+#define SDA04PSEUDOTERMINAL_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QSocketNotifier>
+
+// Master side of a raw pseudo terminal standing in for the reader's UART, shared by Sda04Emulator
+// and Sda04Replay : SecugenSda04 opens portName() as it would open the serial port.
+class Sda04PseudoTerminal : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Sda04PseudoTerminal(QObject *parent = 0);
+    ~Sda04PseudoTerminal();
+
+    bool open();
+    void close();
+    bool isOpen() const { return master >= 0; }
+    QString portName() const;
+
+    // Non blocking : appends what the driver wrote, returns the number of bytes read
+    qint64 read(QByteArray &buffer);
+    qint64 write(const char *data, qint64 size);
+
+signals:
+    // The driver wrote to its end
+    void readyRead();
+
+private:
+    int master;
+    int slave;
+    QString slaveName;
+    QSocketNotifier *notifier;
+};
+
+#endif // SDA04PSEUDOTERMINAL_H
@@ -0,0 +1,106 @@
+#include "sda04_quality.h"
+#include "sda04_bitmap.h"
+#include <QtGlobal>
+#include <cmath>
+
+Sda04Quality::Sda04Quality() :
+    m_valid(false), m_coverage(0), m_contrast(0), m_clarity(0)
+{
+}
+
+Sda04Quality Sda04Quality::assess(const QByteArray &bitmap, int imageSize)
+{
+    if(bitmap.size() != Sda04Bitmap::fileSize(imageSize))
+        return Sda04Quality();
+
+    return assess(reinterpret_cast<const uchar*>(bitmap.constData()) + Sda04Bitmap::HEADER_SIZE,
+                  Sda04Bitmap::width(imageSize), Sda04Bitmap::height(imageSize), Sda04Bitmap::stride(imageSize));
+}
+
+Sda04Quality Sda04Quality::assess(const uchar *pixels, int width, int height, int stride)
+{
+    Sda04Quality quality;
+
+    // Central differences : the one pixel border is left out
+    const int columns = (width - 2) / BLOCK;
+    const int rows = (height - 2) / BLOCK;
+
+    if(columns <= 0 || rows <= 0)
+        return quality;
+
+    int foreground = 0;
+    double variances = 0;
+    double coherences = 0;
+
+    for(int by = 0; by < rows; by++)
+    {
+        for(int bx = 0; bx < columns; bx++)
+        {
+            int sum = 0, squares = 0;
+            int gxx = 0, gyy = 0, gxy = 0;
+
+            for(int y = 0; y < BLOCK; y++)
+            {
+                const uchar *row = pixels + (1 + by * BLOCK + y) * stride + 1 + bx * BLOCK;
+                const uchar *up = row - stride;
+                const uchar *down = row + stride;
+
+                // Fixed length and branch free : unrolled and vectorized by the compiler
+                for(int x = 0; x < BLOCK; x++)
+                {
+                    int p = row[x];
+                    int gx = row[x + 1] - row[x - 1];
+                    int gy = down[x] - up[x];
+
+                    sum += p;
+                    squares += p * p;
+                    gxx += gx * gx;
+                    gyy += gy * gy;
+                    gxy += gx * gy;
+                }
+            }
+
+            const int n = BLOCK * BLOCK;
+            double mean = double(sum) / n;
+            double variance = double(squares) / n - mean * mean;
+
+            if(variance < FOREGROUND_VARIANCE)
+                continue;
+
+            // 1 : parallel ridges, 0 : noise or no dominant orientation
+            double energy = double(gxx) + gyy;
+            double anisotropy = std::sqrt(double(gxx - gyy) * (gxx - gyy) + 4.0 * double(gxy) * gxy);
+
+            foreground++;
+            variances += variance;
+            coherences += energy > 0? anisotropy / energy : 0;
+        }
+    }
+
+    quality.m_valid = true;
+    quality.m_coverage = foreground * 100 / (rows * columns);
+
+    if(foreground > 0)
+    {
+        quality.m_contrast = qRound(std::sqrt(variances / foreground));
+        quality.m_clarity = qRound(coherences * 100 / foreground);
+    }
+
+    return quality;
+}
+
+int Sda04Quality::score() const
+{
+    if(!m_valid)
+        return 0;
+
+    // Contrast saturates : past a point it doesn't make the minutiae any better
+    int contrast = qMin(100, m_contrast * 100 / (2 * MIN_CONTRAST));
+
+    return (m_coverage + m_clarity + contrast) / 3;
+}
+
+bool Sda04Quality::accepted() const
+{
+    return m_valid && m_coverage >= MIN_COVERAGE && m_contrast >= MIN_CONTRAST && m_clarity >= MIN_CLARITY;
+}
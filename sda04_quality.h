@@ -0,0 +1,44 @@
+#ifndef SDA04QUALITY_H
+#define SDA04QUALITY_H
+
+#include <QByteArray>
+
+// Host side quality of a capture, computed on 16 x 16 blocks in a few ms : coverage of the finger,
+// gray level contrast over it and ridge clarity (orientation coherence of the gradients).
+// Lets enrollment retry at once on a bad placement instead of after a reader round trip.
+class Sda04Quality
+{
+public:
+    enum {
+        BLOCK = 16, // px
+        FOREGROUND_VARIANCE = 150, // block variance above which the block shows ridges
+        MIN_COVERAGE = 45, // % of the blocks on the finger
+        MIN_CONTRAST = 18, // gray levels, standard deviation over the finger
+        MIN_CLARITY = 45 // % mean orientation coherence over the finger
+    };
+
+    Sda04Quality();
+
+    // 8 bits grayscale pixels, rows stride bytes apart (any row order)
+    static Sda04Quality assess(const uchar *pixels, int width, int height, int stride);
+    // BMP as returned by SecugenSda04::getImage()
+    static Sda04Quality assess(const QByteArray &bitmap, int imageSize);
+
+    bool isValid() const { return m_valid; }
+    int coverage() const { return m_coverage; }
+    int contrast() const { return m_contrast; }
+    int clarity() const { return m_clarity; }
+
+    // 0 - 100, orders the captures of a best of N selection
+    int score() const;
+    // Good enough to be sent to the reader
+    bool accepted() const;
+
+private:
+    bool m_valid;
+    int m_coverage;
+    int m_contrast;
+    int m_clarity;
+};
+
+#endif // SDA04QUALITY_H
@@ -0,0 +1,66 @@
+#include "sda04_readermanager.h"
+
+Sda04ReaderManager::Sda04ReaderManager(QObject *parent) : QObject(parent)
+{
+}
+
+Sda04ReaderManager::~Sda04ReaderManager()
+{
+    qDeleteAll(readers);
+}
+
+SecugenSda04 *Sda04ReaderManager::addReader(const QString &serialPort, int autoOnPin)
+{
+    SecugenSda04 *reader = new SecugenSda04(serialPort, autoOnPin);
+    const int index = readers.size();
+
+    readers.append(reader);
+
+    connect(reader, &SecugenSda04::fingerDetected, this, [this, index]() {
+        emit fingerDetected(index);
+    });
+
+    return reader;
+}
+
+int Sda04ReaderManager::count() const
+{
+    return readers.size();
+}
+
+SecugenSda04 *Sda04ReaderManager::reader(int index) const
+{
+    return readers.value(index);
+}
+
+QList<int> Sda04ReaderManager::identifyAll()
+{
+    QList<Sda04Reply *> replies;
+    QList<int> results;
+
+    // All submitted first : every reader works while the others do
+    foreach(SecugenSda04 *reader, readers)
+        replies.append(reader->scanFingerAsync());
+
+    foreach(Sda04Reply *reply, replies)
+    {
+        reply->waitForFinished();
+        results.append(reply->result().isValid()? reply->result().toInt() : -3);
+        delete reply;
+    }
+
+    return results;
+}
+
+void Sda04ReaderManager::startIdentifyAll()
+{
+    for(int index = 0; index < readers.size(); index++)
+    {
+        Sda04Reply *reply = readers.at(index)->scanFingerAsync();
+
+        reply->onFinished(this, [this, index, reply]() {
+            emit identified(index, reply->result().isValid()? reply->result().toInt() : -3);
+            reply->deleteLater();
+        });
+    }
+}
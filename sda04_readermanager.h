@@ -0,0 +1,36 @@
+#ifndef SDA04READERMANAGER_H
+#define SDA04READERMANAGER_H
+
+#include <QObject>
+#include <QList>
+#include <secugen_sda04.h>
+
+// Several SDA04 readers in one process, each with its own UART, AutoOn pin and serial thread.
+// Commands to different readers run in parallel.
+class Sda04ReaderManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Sda04ReaderManager(QObject *parent = 0);
+    ~Sda04ReaderManager();
+
+    // The manager owns the reader, its index is the one used by the signals
+    SecugenSda04 *addReader(const QString &serialPort, int autoOnPin);
+    int count() const;
+    SecugenSda04 *reader(int index) const;
+
+    // Identify on every reader at once, one result per reader (as scanFinger())
+    QList<int> identifyAll();
+    // Non blocking version : identified() for each reader as it answers
+    void startIdentifyAll();
+
+signals:
+    void fingerDetected(int reader);
+    void identified(int reader, int result);
+
+private:
+    QList<SecugenSda04 *> readers;
+};
+
+#endif // SDA04READERMANAGER_H
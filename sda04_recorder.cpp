@@ -0,0 +1,103 @@
+#include "sda04_recorder.h"
+#include <QtEndian>
+#include <QDebug>
+
+static const char RECORDER_MAGIC[8] = { 'S', 'D', 'A', '0', '4', 'T', 'R', 'C' };
+
+Sda04Recorder::Sda04Recorder(const QString &fileName) : m_file(fileName), m_baudRate(0)
+{
+}
+
+Sda04Recorder::~Sda04Recorder()
+{
+    close();
+}
+
+bool Sda04Recorder::open()
+{
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "Can't create capture " << m_file.fileName() << " : " << m_file.errorString();
+        return false;
+    }
+
+    uchar header[HEADER_SIZE] = {0};
+    memcpy(header, RECORDER_MAGIC, sizeof(RECORDER_MAGIC));
+    qToLittleEndian<quint32>(VERSION, header + 8);
+    m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    m_baudRate = 0;
+    m_clock.start();
+
+    return true;
+}
+
+void Sda04Recorder::close()
+{
+    if(m_file.isOpen())
+        m_file.close();
+}
+
+void Sda04Recorder::record(Type type, const char *data, qint64 size)
+{
+    if(!m_file.isOpen() || size <= 0)
+        return;
+
+    uchar header[RECORD_HEADER_SIZE];
+    qToLittleEndian<qint64>(m_clock.nsecsElapsed(), header);
+    qToLittleEndian<quint32>(type, header + 8);
+    qToLittleEndian<quint32>(size, header + 12);
+
+    // Buffered : the serial thread never waits for the disk
+    m_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    m_file.write(data, size);
+}
+
+void Sda04Recorder::recordSpeed(qint32 baudRate)
+{
+    if(baudRate == m_baudRate)
+        return;
+
+    uchar speed[4];
+    qToLittleEndian<quint32>(baudRate, speed);
+    record(RECORD_SPEED, reinterpret_cast<const char*>(speed), sizeof(speed));
+    m_baudRate = baudRate;
+}
+
+QList<Sda04Recorder::Record> Sda04Recorder::load(const QString &fileName)
+{
+    QList<Record> records;
+    QFile file(fileName);
+
+    if(!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Can't open capture " << fileName << " : " << file.errorString();
+        return records;
+    }
+
+    QByteArray content = file.readAll();
+    const uchar *data = reinterpret_cast<const uchar*>(content.constData());
+    const qint64 size = content.size();
+
+    if(size < HEADER_SIZE || memcmp(data, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) != 0 || qFromLittleEndian<quint32>(data + 8) != VERSION) {
+        qCritical() << "Invalid capture " << fileName;
+        return records;
+    }
+
+    // A capture cut short (crash, power loss) keeps its complete records
+    qint64 pos = HEADER_SIZE;
+    while(pos + RECORD_HEADER_SIZE <= size)
+    {
+        quint32 length = qFromLittleEndian<quint32>(data + pos + 12);
+        if(pos + RECORD_HEADER_SIZE + length > size)
+            break;
+
+        Record record;
+        record.time = qFromLittleEndian<qint64>(data + pos);
+        record.type = qFromLittleEndian<quint32>(data + pos + 8);
+        record.data = content.mid(pos + RECORD_HEADER_SIZE, length);
+        records.append(record);
+
+        pos += RECORD_HEADER_SIZE + length;
+    }
+
+    return records;
+}
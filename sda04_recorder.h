@@ -0,0 +1,54 @@
+#ifndef SDA04RECORDER_H
+#define SDA04RECORDER_H
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QList>
+
+// Capture of the serial traffic of one reader, little endian :
+//   header : magic, version
+//   records : ns since the start (monotonic), type, size, bytes as written or read
+// Written by the engine thread through the file buffer, read back by Sda04Replay.
+class Sda04Recorder
+{
+public:
+    enum Type {
+        RECORD_WRITE = 0, // host to reader : command frame, then its data
+        RECORD_READ = 1, // reader to host, one record per read
+        RECORD_SPEED = 2 // port speed set, 4 bytes
+    };
+
+    enum {
+        HEADER_SIZE = 16,
+        RECORD_HEADER_SIZE = 16, // time (8), type (4), size (4)
+        VERSION = 1
+    };
+
+    struct Record
+    {
+        qint64 time; // ns
+        int type;
+        QByteArray data;
+    };
+
+    explicit Sda04Recorder(const QString &fileName);
+    ~Sda04Recorder();
+
+    bool open();
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    void record(Type type, const char *data, qint64 size);
+    // Only when it differs from the last one recorded
+    void recordSpeed(qint32 baudRate);
+
+    // Whole capture, empty if the file isn't one
+    static QList<Record> load(const QString &fileName);
+
+private:
+    QFile m_file;
+    QElapsedTimer m_clock;
+    qint32 m_baudRate;
+};
+
+#endif // SDA04RECORDER_H
@@ -0,0 +1,136 @@
+#include "sda04_replay.h"
+#include <QDebug>
+
+Sda04Replay::Sda04Replay(QObject *parent) : QObject(parent),
+    terminal(this), timer(this), cursor(0), anchor(0), speed(1), mismatchCount(0)
+{
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &Sda04Replay::sendNext);
+    connect(&terminal, &Sda04PseudoTerminal::readyRead, this, &Sda04Replay::readCommand);
+}
+
+Sda04Replay::~Sda04Replay()
+{
+    stop();
+}
+
+bool Sda04Replay::load(const QString &fileName)
+{
+    records = Sda04Recorder::load(fileName);
+    cursor = 0;
+    anchor = 0;
+    mismatchCount = 0;
+    input.clear();
+
+    qDebug() << "Replay of " << fileName << " : " << records.size() << " records";
+
+    return !records.isEmpty();
+}
+
+bool Sda04Replay::start()
+{
+    if(terminal.isOpen())
+        return true;
+
+    if(!terminal.open())
+        return false;
+
+    qDebug() << "SDA04 replay on " << terminal.portName();
+
+    // A capture may start with the reader talking
+    clock.start();
+    skipSpeed();
+    schedule();
+
+    return true;
+}
+
+void Sda04Replay::stop()
+{
+    timer.stop();
+    terminal.close();
+}
+
+QString Sda04Replay::portName() const
+{
+    return terminal.portName();
+}
+
+void Sda04Replay::setSpeed(double factor)
+{
+    speed = qMax(0.0, factor);
+}
+
+bool Sda04Replay::atEnd() const
+{
+    return cursor >= records.size();
+}
+
+void Sda04Replay::readCommand()
+{
+    terminal.read(input);
+
+    // Recorded writes matched in order, one per command frame or data packet
+    while(cursor < records.size() && records.at(cursor).type == Sda04Recorder::RECORD_WRITE)
+    {
+        const Sda04Recorder::Record &write = records.at(cursor);
+
+        if(input.size() < write.data.size())
+            return;
+
+        if(memcmp(input.constData(), write.data.constData(), write.data.size()) != 0)
+        {
+            mismatchCount++;
+            qWarning() << "Replay : write " << cursor << " differs from the capture";
+        }
+
+        input.remove(0, write.data.size());
+        anchor = write.time;
+        clock.start();
+        cursor++;
+        skipSpeed();
+    }
+
+    // Unexpected bytes (capture over or a command it doesn't hold) : dropped
+    if(atEnd() || records.at(cursor).type != Sda04Recorder::RECORD_WRITE)
+        input.clear();
+
+    schedule();
+}
+
+void Sda04Replay::sendNext()
+{
+    if(atEnd() || records.at(cursor).type != Sda04Recorder::RECORD_READ)
+        return;
+
+    const QByteArray &data = records.at(cursor).data;
+    if(terminal.write(data.constData(), data.size()) != data.size())
+        qWarning() << "Replay : read " << cursor << " not fully sent";
+
+    cursor++;
+    skipSpeed();
+    schedule();
+}
+
+void Sda04Replay::skipSpeed()
+{
+    // The terminal has no speed : only the timing of the reads matters
+    while(cursor < records.size() && records.at(cursor).type == Sda04Recorder::RECORD_SPEED)
+        cursor++;
+
+    if(atEnd())
+        emit finished();
+}
+
+void Sda04Replay::schedule()
+{
+    if(atEnd() || records.at(cursor).type != Sda04Recorder::RECORD_READ || timer.isActive())
+        return;
+
+    // Delay after the matching write in the capture, scaled
+    qint64 delay = 0;
+    if(speed > 0)
+        delay = qMax<qint64>(0, (records.at(cursor).time - anchor) / 1000000 / speed - clock.elapsed());
+
+    timer.start(delay);
+}
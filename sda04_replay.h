@@ -0,0 +1,57 @@
+#ifndef SDA04REPLAY_H
+#define SDA04REPLAY_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <sda04_recorder.h>
+#include <sda04_pseudoterminal.h>
+
+// Plays a Sda04Recorder capture back on a pseudo terminal : SecugenSda04 opens portName() as it would
+// open the reader. Each recorded write is awaited from the driver, then the reads that followed it are
+// sent with their original delays, divided by the speed factor. The driver has to issue the commands
+// of the capture in the same order, which makes a field trace a repeatable latency benchmark.
+class Sda04Replay : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Sda04Replay(QObject *parent = 0);
+    ~Sda04Replay();
+
+    bool load(const QString &fileName);
+    Q_INVOKABLE bool start();
+    Q_INVOKABLE void stop();
+    Q_INVOKABLE QString portName() const;
+
+    // 1 : original timing, 10 : ten times faster, 0 : no delay at all
+    void setSpeed(double factor);
+
+    Q_INVOKABLE bool atEnd() const;
+    // Writes of the driver that didn't match the capture
+    Q_INVOKABLE int mismatches() const { return mismatchCount; }
+
+signals:
+    void finished();
+
+private slots:
+    void readCommand();
+    void sendNext();
+
+private:
+    Sda04PseudoTerminal terminal;
+    QTimer timer;
+    QElapsedTimer clock;
+    QByteArray input;
+
+    QList<Sda04Recorder::Record> records;
+    int cursor;
+    qint64 anchor; // ns, capture time of the last write matched
+    double speed;
+    int mismatchCount;
+
+    void skipSpeed();
+    void schedule();
+};
+
+#endif // SDA04REPLAY_H
@@ -0,0 +1,94 @@
+#include "sda04_synccheckpoint.h"
+#include <QtEndian>
+#include <QDebug>
+
+static const char CHECKPOINT_MAGIC[8] = { 'S', 'D', 'A', '0', '4', 'C', 'K', 'P' };
+
+Sda04SyncCheckpoint::Sda04SyncCheckpoint(const QString &fileName) : file(fileName), map(0)
+{
+}
+
+Sda04SyncCheckpoint::~Sda04SyncCheckpoint()
+{
+    close();
+}
+
+bool Sda04SyncCheckpoint::open()
+{
+    if(map)
+        return true;
+
+    if(!file.open(QIODevice::ReadWrite)) {
+        qCritical() << "Can't open sync checkpoint " << file.fileName() << " : " << file.errorString();
+        return false;
+    }
+
+    const qint64 size = HEADER_SIZE + (qint64)(MAX_USER_ID + 1) * 4;
+    bool create = (file.size() == 0);
+
+    if(create && !file.resize(size)) {
+        qCritical() << "Can't size sync checkpoint " << file.fileName();
+        file.close();
+        return false;
+    }
+
+    map = file.map(0, file.size());
+
+    if(!map) {
+        qCritical() << "Can't map sync checkpoint " << file.fileName() << " : " << file.errorString();
+        file.close();
+        return false;
+    }
+
+    if(create)
+    {
+        memcpy(map, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        qToLittleEndian<quint32>(VERSION, map + 8);
+    }
+
+    if(memcmp(map, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || qFromLittleEndian<quint32>(map + 8) != VERSION || file.size() < size)
+    {
+        qCritical() << "Invalid sync checkpoint " << file.fileName();
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void Sda04SyncCheckpoint::close()
+{
+    if(map)
+        file.unmap(map);
+    map = 0;
+
+    if(file.isOpen())
+        file.close();
+}
+
+bool Sda04SyncCheckpoint::isOpen() const
+{
+    return map != 0;
+}
+
+quint32 Sda04SyncCheckpoint::digest(int userID) const
+{
+    if(!map || userID < 1 || userID > MAX_USER_ID)
+        return 0;
+
+    return qFromLittleEndian<quint32>(map + HEADER_SIZE + userID * 4);
+}
+
+void Sda04SyncCheckpoint::setDigest(int userID, quint32 digest)
+{
+    if(!map || userID < 1 || userID > MAX_USER_ID)
+        return;
+
+    qToLittleEndian<quint32>(digest, map + HEADER_SIZE + userID * 4);
+}
+
+void Sda04SyncCheckpoint::clear()
+{
+    if(map)
+        memset(map + HEADER_SIZE, 0, (MAX_USER_ID + 1) * 4);
+}
@@ -0,0 +1,34 @@
+#ifndef SDA04SYNCCHECKPOINT_H
+#define SDA04SYNCCHECKPOINT_H
+
+#include <QFile>
+
+// Digest of every record last confirmed on one reader, so an interrupted sync resumes where it stopped.
+// The file is memory mapped : each confirmation is one 4 bytes store, nothing is rewritten.
+class Sda04SyncCheckpoint
+{
+public:
+    enum {
+        MAX_USER_ID = 9999,
+        HEADER_SIZE = 16,
+        VERSION = 1
+    };
+
+    explicit Sda04SyncCheckpoint(const QString &fileName);
+    ~Sda04SyncCheckpoint();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    // 0 : the record on the reader is unknown
+    quint32 digest(int userID) const;
+    void setDigest(int userID, quint32 digest);
+    void clear();
+
+private:
+    QFile file;
+    uchar *map;
+};
+
+#endif // SDA04SYNCCHECKPOINT_H
@@ -0,0 +1,149 @@
+#include "sda04_template.h"
+
+Sda04Template::Sda04Template(const char *data, int size, int format) :
+    m_data(reinterpret_cast<const uchar*>(data)), m_size(size), m_format(format), m_length(0), m_header(0), m_views(0)
+{
+    m_error = parse();
+}
+
+Sda04Template::Error Sda04Template::parse()
+{
+    if(!m_data || m_size <= 0)
+        return TEMPLATE_TRUNCATED;
+
+    // SG400 is opaque : only its size can be checked
+    if(m_format != FORMAT_ANSI378)
+    {
+        m_length = m_size;
+        return (m_size <= SLOT_SIZE)? TEMPLATE_VALID : TEMPLATE_TOO_LARGE;
+    }
+
+    if(m_size < 26)
+        return TEMPLATE_TRUNCATED;
+    if(memcmp(m_data, "FMR\0", 4) != 0 || memcmp(m_data + 4, " 20\0", 4) != 0)
+        return TEMPLATE_BAD_MAGIC;
+
+    // 2 bytes record length, or 0 followed by 4 bytes
+    m_length = qFromBigEndian<quint16>(m_data + 8);
+    m_header = 26;
+    if(m_length == 0)
+    {
+        if(m_size < 30)
+            return TEMPLATE_TRUNCATED;
+        m_length = qFromBigEndian<quint32>(m_data + 10);
+        m_header = 30;
+    }
+
+    if(m_length < m_header)
+        return TEMPLATE_BAD_LENGTH;
+    if(m_length > m_size)
+        return TEMPLATE_TRUNCATED;
+
+    m_views = m_data[m_header - 2];
+    if(m_views == 0 || m_views > MAX_VIEWS)
+        return TEMPLATE_BAD_VIEW;
+
+    const int w = width();
+    const int h = height();
+    int offset = m_header;
+
+    for(int i = 0; i < m_views; i++)
+    {
+        // View header, minutiae, then the extended data block length
+        if(offset + 4 > m_length)
+            return TEMPLATE_BAD_VIEW;
+
+        const int count = m_data[offset + 3];
+        const int extended = offset + 4 + count * 6;
+        if(extended + 2 > m_length)
+            return TEMPLATE_BAD_VIEW;
+
+        const uchar *m = m_data + offset + 4;
+        for(int k = 0; k < count; k++, m += 6)
+        {
+            Sda04Minutia minutia(m);
+            if(minutia.type() > 2 || minutia.angle() >= 180 || (w && minutia.x() >= w) || (h && minutia.y() >= h))
+                return TEMPLATE_BAD_MINUTIA;
+        }
+
+        m_viewOffset[i] = offset;
+        offset = extended + 2 + qFromBigEndian<quint16>(m_data + extended);
+        if(offset > m_length)
+            return TEMPLATE_BAD_VIEW;
+    }
+
+    if(offset != m_length)
+        return TEMPLATE_BAD_LENGTH;
+    if(m_length > SLOT_SIZE)
+        return TEMPLATE_TOO_LARGE;
+
+    return TEMPLATE_VALID;
+}
+
+int Sda04Template::width() const
+{
+    return (m_header && m_length >= m_header)? qFromBigEndian<quint16>(m_data + m_header - 10) : 0;
+}
+
+int Sda04Template::height() const
+{
+    return (m_header && m_length >= m_header)? qFromBigEndian<quint16>(m_data + m_header - 8) : 0;
+}
+
+int Sda04Template::resolutionX() const
+{
+    return (m_header && m_length >= m_header)? qFromBigEndian<quint16>(m_data + m_header - 6) : 0;
+}
+
+int Sda04Template::resolutionY() const
+{
+    return (m_header && m_length >= m_header)? qFromBigEndian<quint16>(m_data + m_header - 4) : 0;
+}
+
+Sda04FingerView Sda04Template::view(int i) const
+{
+    if(!isValid() || m_format != FORMAT_ANSI378 || i < 0 || i >= m_views)
+        return Sda04FingerView();
+
+    int end = (i + 1 < m_views)? m_viewOffset[i + 1] : m_length;
+    return Sda04FingerView(m_data + m_viewOffset[i], end - m_viewOffset[i]);
+}
+
+int Sda04Template::minutiaeCount() const
+{
+    int count = 0;
+    for(int i = 0; i < viewCount(); i++)
+        count += view(i).minutiaeCount();
+    return count;
+}
+
+Sda04Template::Error Sda04Template::validate(const QByteArray &templates, int format)
+{
+    Sda04Template first(templates.constData(), templates.size(), format);
+
+    if(!first.isValid() || format != FORMAT_ANSI378 || first.length() == templates.size())
+        return first.error();
+
+    // ANSI378 : a second record may follow the first one
+    Sda04Template second(templates.constData() + first.length(), templates.size() - first.length(), format);
+
+    if(second.isValid() && first.length() + second.length() != templates.size())
+        return TEMPLATE_BAD_LENGTH;
+
+    return second.error();
+}
+
+const char *Sda04Template::errorString(Error error)
+{
+    switch(error)
+    {
+    case TEMPLATE_VALID: return "valid";
+    case TEMPLATE_TRUNCATED: return "truncated";
+    case TEMPLATE_BAD_MAGIC: return "not an ANSI378 record";
+    case TEMPLATE_BAD_LENGTH: return "inconsistent record length";
+    case TEMPLATE_BAD_VIEW: return "invalid finger view";
+    case TEMPLATE_BAD_MINUTIA: return "minutia out of range";
+    case TEMPLATE_TOO_LARGE: return "larger than a reader slot";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef SDA04TEMPLATE_H
+#define SDA04TEMPLATE_H
+
+#include <QByteArray>
+#include <QtEndian>
+
+// One minutia of an ANSI378 finger view (6 bytes)
+class Sda04Minutia
+{
+public:
+    explicit Sda04Minutia(const uchar *data) : m_data(data) {}
+
+    int type() const { return m_data[0] >> 6; }
+    int x() const { return ((m_data[0] & 0x3F) << 8) | m_data[1]; }
+    int y() const { return ((m_data[2] & 0x3F) << 8) | m_data[3]; }
+    int angle() const { return m_data[4]; } // 2 degrees units
+    int quality() const { return m_data[5]; }
+
+private:
+    const uchar *m_data;
+};
+
+// Finger view of an ANSI378 record : 4 bytes header, minutiae, extended data block
+class Sda04FingerView
+{
+public:
+    Sda04FingerView() : m_data(0), m_length(0) {}
+    Sda04FingerView(const uchar *data, int length) : m_data(data), m_length(length) {}
+
+    bool isValid() const { return m_data != 0; }
+    int position() const { return m_data[0]; }
+    int viewNumber() const { return m_data[1] >> 4; }
+    int impression() const { return m_data[1] & 0x0F; }
+    int quality() const { return m_data[2]; }
+    int minutiaeCount() const { return m_data[3]; }
+    Sda04Minutia minutia(int i) const { return Sda04Minutia(m_data + 4 + i * 6); }
+    const uchar *minutiae() const { return m_data + 4; }
+    int length() const { return m_length; }
+
+private:
+    const uchar *m_data;
+    int m_length;
+};
+
+// View over a template buffer : the structure is checked once, fields are read in place.
+// Nothing is copied, the buffer must outlive the view.
+class Sda04Template
+{
+public:
+    enum Error {
+        TEMPLATE_VALID = 0,
+        TEMPLATE_TRUNCATED, // buffer shorter than the record
+        TEMPLATE_BAD_MAGIC, // not "FMR\0" / " 20\0"
+        TEMPLATE_BAD_LENGTH, // record length inconsistent with its views
+        TEMPLATE_BAD_VIEW, // no finger view, or one running past the record
+        TEMPLATE_BAD_MINUTIA, // minutia out of the image or of range
+        TEMPLATE_TOO_LARGE // doesn't fit a reader slot (800 bytes)
+    };
+
+    enum {
+        SLOT_SIZE = 800,
+        MAX_VIEWS = 16
+    };
+
+    // Values of SecugenSda04::formatMinutiae
+    enum Format {
+        FORMAT_SG400 = 0,
+        FORMAT_ANSI378 = 1
+    };
+
+    // format : SecugenSda04::ANSI378 or SecugenSda04::SG400
+    Sda04Template(const char *data = 0, int size = 0, int format = FORMAT_ANSI378);
+
+    bool isValid() const { return m_error == TEMPLATE_VALID; }
+    Error error() const { return m_error; }
+    int format() const { return m_format; }
+
+    // Bytes used by the record : the next one starts right after
+    int length() const { return m_length; }
+    const char *data() const { return reinterpret_cast<const char*>(m_data); }
+
+    // ANSI378 header
+    int width() const;
+    int height() const;
+    int resolutionX() const;
+    int resolutionY() const;
+    int viewCount() const { return m_views; }
+    Sda04FingerView view(int i) const;
+    int minutiaeCount() const; // all views
+
+    // One or two records back to back, as sent to the reader with command 0x71
+    static Error validate(const QByteArray &templates, int format);
+    static const char *errorString(Error error);
+
+private:
+    const uchar *m_data;
+    int m_size;
+    int m_format;
+    Error m_error;
+    int m_length;
+    int m_header;
+    int m_views;
+    int m_viewOffset[MAX_VIEWS];
+
+    Error parse();
+};
+
+#endif // SDA04TEMPLATE_H
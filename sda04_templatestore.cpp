@@ -0,0 +1,315 @@
+#include "sda04_templatestore.h"
+#include "sda04_engine.h"
+#include "sda04_template.h"
+#include <QtEndian>
+
+static const char STORE_MAGIC[8] = { 'S', 'D', 'A', '0', '4', 'T', 'P', 'L' };
+
+Sda04TemplateStore::Sda04TemplateStore(const QString &fileName) : file(fileName), map(0), m_format(Sda04Template::FORMAT_ANSI378), m_recordSize(0)
+{
+}
+
+Sda04TemplateStore::~Sda04TemplateStore()
+{
+    close();
+}
+
+bool Sda04TemplateStore::open(int format)
+{
+    if(map)
+        return true;
+
+    if(!file.open(QIODevice::ReadWrite)) {
+        qCritical() << "Can't open template store " << file.fileName() << " : " << file.errorString();
+        return false;
+    }
+
+    bool create = (file.size() == 0);
+
+    if(create)
+    {
+        // Sparse file : only the slots written use disk space
+        if(!file.resize(HEADER_SIZE + (qint64)MAX_USER_ID * recordSize(format))) {
+            qCritical() << "Can't size template store " << file.fileName();
+            file.close();
+            return false;
+        }
+    }
+
+    map = file.map(0, file.size());
+
+    if(!map) {
+        qCritical() << "Can't map template store " << file.fileName() << " : " << file.errorString();
+        file.close();
+        return false;
+    }
+
+    if(create)
+    {
+        memcpy(map, STORE_MAGIC, sizeof(STORE_MAGIC));
+        qToLittleEndian<quint32>(VERSION, map + 8);
+        qToLittleEndian<quint32>(format, map + 12);
+        qToLittleEndian<quint32>(recordSize(format), map + 16);
+        qToLittleEndian<quint32>(0, map + 20);
+    }
+
+    m_format = qFromLittleEndian<quint32>(map + 12);
+    m_recordSize = qFromLittleEndian<quint32>(map + 16);
+
+    if(memcmp(map, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 || qFromLittleEndian<quint32>(map + 8) != VERSION
+            || m_recordSize != recordSize(m_format) || file.size() < HEADER_SIZE + (qint64)MAX_USER_ID * m_recordSize)
+    {
+        qCritical() << "Invalid template store " << file.fileName();
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void Sda04TemplateStore::close()
+{
+    if(map)
+        file.unmap(map);
+    map = 0;
+
+    if(file.isOpen())
+        file.close();
+}
+
+bool Sda04TemplateStore::isOpen() const
+{
+    return map != 0;
+}
+
+int Sda04TemplateStore::format() const
+{
+    return m_format;
+}
+
+int Sda04TemplateStore::recordSize() const
+{
+    return m_recordSize;
+}
+
+int Sda04TemplateStore::count() const
+{
+    return map? qFromLittleEndian<quint32>(map + 20) : 0;
+}
+
+bool Sda04TemplateStore::contains(int userID) const
+{
+    if(!map || userID < 1 || userID > MAX_USER_ID)
+        return false;
+
+    return map[BITMAP_OFFSET + userID / 8] & (1 << (userID % 8));
+}
+
+QList<int> Sda04TemplateStore::ids() const
+{
+    QList<int> list;
+
+    if(!map)
+        return list;
+
+    list.reserve(count());
+
+    for(int i = 0; i <= MAX_USER_ID / 8; i++)
+    {
+        uchar bits = map[BITMAP_OFFSET + i];
+
+        for(int bit = 0; bits; bit++, bits >>= 1)
+            if(bits & 1)
+                list.append(i * 8 + bit);
+    }
+
+    return list;
+}
+
+QByteArray Sda04TemplateStore::record(int userID) const
+{
+    if(!contains(userID))
+        return QByteArray();
+
+    return QByteArray::fromRawData(slot(userID), m_recordSize);
+}
+
+const char *Sda04TemplateStore::recordData(int userID) const
+{
+    return contains(userID)? slot(userID) : 0;
+}
+
+bool Sda04TemplateStore::setRecord(int userID, const QByteArray &record)
+{
+    if(!map || userID < 1 || userID > MAX_USER_ID || record.size() != m_recordSize)
+        return false;
+
+    memcpy(slot(userID), record.constData(), m_recordSize);
+    setPresent(userID, true);
+
+    return true;
+}
+
+bool Sda04TemplateStore::setTemplates(int userID, const QByteArray &templates)
+{
+    if(!map || userID < 1 || userID > MAX_USER_ID)
+        return false;
+
+    // Built directly in the mapped slot
+    if(!buildRecord(slot(userID), userID, templates, m_format))
+        return false;
+
+    setPresent(userID, true);
+
+    return true;
+}
+
+bool Sda04TemplateStore::remove(int userID)
+{
+    if(!contains(userID))
+        return false;
+
+    memset(slot(userID), 0, m_recordSize);
+    setPresent(userID, false);
+
+    return true;
+}
+
+quint32 Sda04TemplateStore::digest(int userID) const
+{
+    return contains(userID)? recordDigest(slot(userID), m_recordSize) : 0;
+}
+
+QList<int> Sda04TemplateStore::invalidRecords() const
+{
+    QList<int> invalid;
+
+    // Checked in place in the mapped slots
+    foreach(int userID, ids())
+    {
+        const char *record = slot(userID);
+        bool valid = Sda04Template(record + 4, 800, m_format).isValid();
+
+        if(m_format == Sda04Template::FORMAT_ANSI378)
+            valid = valid && Sda04Template(record + 804, 800, m_format).isValid();
+
+        if(!valid)
+            invalid.append(userID);
+    }
+
+    return invalid;
+}
+
+int Sda04TemplateStore::recordSize(int format)
+{
+    // ID + master + templates + trailer
+    return 2 + 2 + ((format == Sda04Template::FORMAT_ANSI378)? 1600 : 800) + 11 + 1;
+}
+
+bool Sda04TemplateStore::buildRecord(char *record, int userID, const QByteArray &templates, int format)
+{
+    const int size = recordSize(format);
+    const char *data = templates.constData();
+    const int sizeTotal = templates.size();
+    bool ok = true;
+
+    memset(record, 0x00, size - 12);
+    memset(record + size - 12, 0xFF, 12);
+
+    // User ID (BCD), master flag cleared
+    quint16 id = Sda04Command::toBcd(userID);
+    record[0] = id & 0xFF;
+    record[1] = id >> 8;
+
+    if(format == Sda04Template::FORMAT_ANSI378)
+    {
+        // ANSI378 : one or two records, a single one is stored in both slots
+        Sda04Template t1(data, sizeTotal, format);
+        Sda04Template t2 = t1;
+
+        if(t1.isValid() && t1.length() < sizeTotal)
+            t2 = Sda04Template(data + t1.length(), sizeTotal - t1.length(), format);
+
+        ok = (Sda04Template::validate(templates, format) == Sda04Template::TEMPLATE_VALID);
+
+        if(ok)
+        {
+            memcpy(record + 4, t1.data(), t1.length());
+            memcpy(record + 804, t2.data(), t2.length());
+        }
+
+    } else {
+
+        ok = sizeTotal > 0 && sizeTotal <= 800;
+        memcpy(record + 4, data, qMin(sizeTotal, 800));
+    }
+
+    return ok;
+}
+
+// CRC-32 (IEEE) lookup table
+struct Sda04CrcTable
+{
+    Sda04CrcTable()
+    {
+        for(quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1)? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            entries[i] = c;
+        }
+    }
+
+    quint32 entries[256];
+};
+
+// Running CRC-32 over more data, started at 0xFFFFFFFF and inverted at the end
+static quint32 crcUpdate(quint32 crc, const char *data, int size)
+{
+    // Built once on first use, thread safe : digests come from several reader threads at once
+    static const Sda04CrcTable crcTable;
+    const quint32 *table = crcTable.entries;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+
+    for(int i = 0; i < size; i++)
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+quint32 Sda04TemplateStore::digest(const char *data, int size)
+{
+    // 0 is kept for "no digest"
+    quint32 crc = ~crcUpdate(0xFFFFFFFF, data, size);
+    return crc? crc : 1;
+}
+
+quint32 Sda04TemplateStore::recordDigest(const char *record, int size)
+{
+    // User ID and templates only : the master flag and the trailer come from the reader,
+    // buildRecord() clears them, so records read back from the reader hash the same as the stored ones
+    quint32 crc = crcUpdate(0xFFFFFFFF, record, 2);
+    crc = ~crcUpdate(crc, record + 4, size - 4 - 12);
+    return crc? crc : 1;
+}
+
+char *Sda04TemplateStore::slot(int userID) const
+{
+    return reinterpret_cast<char*>(map + HEADER_SIZE + (qint64)(userID - 1) * m_recordSize);
+}
+
+void Sda04TemplateStore::setPresent(int userID, bool present)
+{
+    uchar &bits = map[BITMAP_OFFSET + userID / 8];
+    uchar bit = 1 << (userID % 8);
+    quint32 total = qFromLittleEndian<quint32>(map + 20);
+
+    if(present && !(bits & bit))
+        total++;
+    if(!present && (bits & bit))
+        total--;
+
+    bits = present? (bits | bit) : (bits & ~bit);
+    qToLittleEndian<quint32>(total, map + 20);
+}
@@ -0,0 +1,66 @@
+#ifndef SDA04TEMPLATESTORE_H
+#define SDA04TEMPLATESTORE_H
+
+#include <QFile>
+#include <QList>
+#include <sda04_template.h>
+
+// Binary copy of the reader database : one fixed size slot per user ID, in the 0x71 record layout
+// (user ID, master flag, two 800 bytes ANSI378 templates or one SG400 template, 12 bytes trailer).
+// The file is memory mapped : records are read and written in place.
+class Sda04TemplateStore
+{
+public:
+    enum {
+        MAX_USER_ID = 9999,
+        HEADER_SIZE = 4096,
+        BITMAP_OFFSET = 64,
+        VERSION = 1
+    };
+
+    explicit Sda04TemplateStore(const QString &fileName);
+    ~Sda04TemplateStore();
+
+    // format : SecugenSda04::ANSI378 or SecugenSda04::SG400, used when the file is created
+    bool open(int format = Sda04Template::FORMAT_ANSI378);
+    void close();
+    bool isOpen() const;
+
+    int format() const;
+    int recordSize() const;
+    int count() const;
+
+    bool contains(int userID) const;
+    QList<int> ids() const;
+
+    // Views over the mapped slot, valid until close()
+    QByteArray record(int userID) const;
+    const char *recordData(int userID) const;
+
+    bool setRecord(int userID, const QByteArray &record);
+    bool setTemplates(int userID, const QByteArray &templates);
+    bool remove(int userID);
+
+    // Users whose record doesn't hold well formed templates
+    QList<int> invalidRecords() const;
+
+    // recordDigest() of the slot, 0 when the slot is empty
+    quint32 digest(int userID) const;
+
+    static int recordSize(int format);
+    static bool buildRecord(char *record, int userID, const QByteArray &templates, int format);
+    static quint32 digest(const char *data, int size);
+    // CRC-32 of the user ID and templates of a record, master flag and trailer left out
+    static quint32 recordDigest(const char *record, int size);
+
+private:
+    QFile file;
+    uchar *map;
+    int m_format;
+    int m_recordSize;
+
+    char *slot(int userID) const;
+    void setPresent(int userID, bool present);
+};
+
+#endif // SDA04TEMPLATESTORE_H
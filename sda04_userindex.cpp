@@ -0,0 +1,168 @@
+#include "sda04_userindex.h"
+
+Sda04UserIndex::Sda04UserIndex() : loaded(false), size(0)
+{
+    memset(reserved, 0, sizeof(reserved));
+    reset();
+}
+
+void Sda04UserIndex::reset()
+{
+    memset(words, 0, sizeof(words));
+
+    // ID 0 and the bits after MAX_USER_ID never hold a user
+    words[0] |= 1;
+    for(int i = MAX_USER_ID + 1; i < WORDS * 64; i++)
+        words[i / 64] |= Q_UINT64_C(1) << (i % 64);
+
+    size = 0;
+}
+
+void Sda04UserIndex::clear()
+{
+    QMutexLocker locker(&lock);
+    reset();
+    loaded = false;
+}
+
+void Sda04UserIndex::load(const QList<int> &ids)
+{
+    QMutexLocker locker(&lock);
+    reset();
+
+    foreach(int userID, ids)
+    {
+        if(userID < 1 || userID > MAX_USER_ID)
+            continue;
+
+        quint64 bit = Q_UINT64_C(1) << (userID % 64);
+
+        if(!(words[userID / 64] & bit))
+        {
+            words[userID / 64] |= bit;
+            size++;
+        }
+    }
+
+    loaded = true;
+}
+
+bool Sda04UserIndex::isLoaded() const
+{
+    QMutexLocker locker(&lock);
+    return loaded;
+}
+
+void Sda04UserIndex::insert(int userID)
+{
+    if(userID < 1 || userID > MAX_USER_ID)
+        return;
+
+    QMutexLocker locker(&lock);
+    quint64 bit = Q_UINT64_C(1) << (userID % 64);
+
+    if(!(words[userID / 64] & bit))
+    {
+        words[userID / 64] |= bit;
+        size++;
+    }
+}
+
+void Sda04UserIndex::remove(int userID)
+{
+    if(userID < 1 || userID > MAX_USER_ID)
+        return;
+
+    QMutexLocker locker(&lock);
+    quint64 bit = Q_UINT64_C(1) << (userID % 64);
+
+    if(words[userID / 64] & bit)
+    {
+        words[userID / 64] &= ~bit;
+        size--;
+    }
+}
+
+bool Sda04UserIndex::contains(int userID) const
+{
+    if(userID < 1 || userID > MAX_USER_ID)
+        return false;
+
+    QMutexLocker locker(&lock);
+    return words[userID / 64] & (Q_UINT64_C(1) << (userID % 64));
+}
+
+int Sda04UserIndex::count() const
+{
+    QMutexLocker locker(&lock);
+    return size;
+}
+
+int Sda04UserIndex::firstFree() const
+{
+    QMutexLocker locker(&lock);
+
+    for(int w = 0; w < WORDS; w++)
+    {
+        quint64 used = words[w] | reserved[w];
+
+        if(used != ~Q_UINT64_C(0))
+            return w * 64 + qCountTrailingZeroBits(~used);
+    }
+
+    return MAX_USER_ID + 1;
+}
+
+int Sda04UserIndex::reserve()
+{
+    QMutexLocker locker(&lock);
+
+    for(int w = 0; w < WORDS; w++)
+    {
+        quint64 used = words[w] | reserved[w];
+
+        if(used != ~Q_UINT64_C(0))
+        {
+            int userID = w * 64 + qCountTrailingZeroBits(~used);
+            reserved[w] |= Q_UINT64_C(1) << (userID % 64);
+            return userID;
+        }
+    }
+
+    return MAX_USER_ID + 1;
+}
+
+void Sda04UserIndex::release(int userID)
+{
+    if(userID < 1 || userID > MAX_USER_ID)
+        return;
+
+    QMutexLocker locker(&lock);
+    reserved[userID / 64] &= ~(Q_UINT64_C(1) << (userID % 64));
+}
+
+QList<int> Sda04UserIndex::ids() const
+{
+    QMutexLocker locker(&lock);
+    QList<int> list;
+    list.reserve(size);
+
+    for(int w = 0; w < WORDS; w++)
+    {
+        quint64 word = words[w];
+
+        // Skip the reserved bits
+        if(w == 0)
+            word &= ~Q_UINT64_C(1);
+        if(w == WORDS - 1)
+            word &= (Q_UINT64_C(1) << ((MAX_USER_ID + 1) % 64)) - 1;
+
+        while(word)
+        {
+            list.append(w * 64 + qCountTrailingZeroBits(word));
+            word &= word - 1;
+        }
+    }
+
+    return list;
+}
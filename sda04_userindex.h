@@ -0,0 +1,46 @@
+#ifndef SDA04USERINDEX_H
+#define SDA04USERINDEX_H
+
+#include <QList>
+#include <QMutex>
+#include <QtAlgorithms>
+
+// Host side copy of the IDs stored in the reader : one bit per user ID
+class Sda04UserIndex
+{
+public:
+    enum {
+        MAX_USER_ID = 9999,
+        WORDS = (MAX_USER_ID + 64) / 64
+    };
+
+    Sda04UserIndex();
+
+    void clear();
+    void load(const QList<int> &ids);
+    bool isLoaded() const;
+
+    void insert(int userID);
+    void remove(int userID);
+    bool contains(int userID) const;
+    int count() const;
+
+    // Lowest ID neither used nor reserved, MAX_USER_ID + 1 when the database is full
+    int firstFree() const;
+
+    // Takes firstFree() out of the free IDs until release(), for an enrollment in progress
+    int reserve();
+    void release(int userID);
+    QList<int> ids() const;
+
+private:
+    mutable QMutex lock;
+    quint64 words[WORDS];
+    quint64 reserved[WORDS]; // kept across load()
+    bool loaded;
+    int size;
+
+    void reset();
+};
+
+#endif // SDA04USERINDEX_H
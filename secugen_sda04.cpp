@@ -1,32 +1,82 @@
 #include "secugen_sda04.h"
+#include <QSettings>
+#include <QtConcurrent/QtConcurrent>
+#include <QImage>
 #define CMD_GET_VERSION 0x05
 
-Trigger trigger;
-void interrupt()
+// AutoOn line of each reader : wiringPi ISRs take no argument, so every pin has its own entry point
+static QAtomicPointer<Trigger> triggers[SecugenSda04::MAX_AUTOON_PINS];
+
+template<int PIN> static void interrupt()
 {
-    emit trigger.triggered();
+    Trigger *trigger = triggers[PIN].loadAcquire();
+    if(trigger)
+        emit trigger->triggered();
 }
 
+#define SDA04_ISR4(n) &interrupt<n>, &interrupt<n + 1>, &interrupt<n + 2>, &interrupt<n + 3>
+#define SDA04_ISR16(n) SDA04_ISR4(n), SDA04_ISR4(n + 4), SDA04_ISR4(n + 8), SDA04_ISR4(n + 12)
+
+static void (*const interrupts[SecugenSda04::MAX_AUTOON_PINS])(void) = {
+    SDA04_ISR16(0), SDA04_ISR16(16), SDA04_ISR16(32), SDA04_ISR16(48)
+};
+
 SecugenSda04::SecugenSda04(const QString serialPort, int AutoOnPin): IFingerprint() {
 
     error = false;
-    timeoutSerial = 5;
-    serial.setPortName(serialPort);
+    this->serialPort = serialPort;
+    touchClock.start();
+    touchDebounce = TOUCH_DEBOUNCE;
+    lastTouch = -TOUCH_DEBOUNCE;
+    identifying = 0;
+
+    // Every serial transfer runs on its own thread
+    engine = new Sda04Engine(serialPort);
+    engine->setLinkReady(false);
+    engine->moveToThread(&workerThread);
+    connect(&workerThread, &QThread::finished, engine, &QObject::deleteLater);
+    workerThread.start();
+
     qDebug() << "Init fingerprintreader Secugen on " << serialPort;
 
-    wiringPiSetup();
-    wiringPiISR(AutoOnPin, INT_EDGE_FALLING, *interrupt);
+    // The pin belongs to this reader until it's destroyed
+    autoOnPin = NO_AUTOON;
+    if(AutoOnPin >= 0 && AutoOnPin < MAX_AUTOON_PINS && triggers[AutoOnPin].testAndSetOrdered(0, &trigger))
+        autoOnPin = AutoOnPin;
+    else if(AutoOnPin != NO_AUTOON)
+        qCritical() << "AutoOn pin " << AutoOnPin << " invalid or already used by another reader";
+
+#ifndef SDA04_NO_WIRINGPI
+    static const int setup = wiringPiSetup();
+    Q_UNUSED(setup);
+
+    // wiringPi can't remove an ISR : each pin gets one for the process, routed through triggers
+    static QAtomicInt registered[MAX_AUTOON_PINS];
+    if(autoOnPin >= 0 && registered[autoOnPin].testAndSetOrdered(0, 1))
+        wiringPiISR(autoOnPin, INT_EDGE_FALLING, interrupts[autoOnPin]);
+#else
+    // Built without GPIO (emulator, desktop) : no AutoOn interrupt
+    Q_UNUSED(interrupts);
+#endif
 
-    DataContainer dataContainer;
-    // Set Reader to 57.600 Bauds
-    executeCommand(0x21,dataContainer,0x00,0x03,0x00,0x00,0x00,0x00,0x00,0x00,QByteArray(),QSerialPort::Baud9600);
-    // Wait for change baud
-    QThread::sleep(2);
-    // Check fingerprint reader status
-    executeCommand(0x30,dataContainer,0x00,0x04);
+    connect(engine, &Sda04Engine::deviceError, this, &SecugenSda04::sendError);
+    connect(engine, &Sda04Engine::serialTimeout, this, [this]() { error = true; });
+    connect(&metricsTimer, &QTimer::timeout, this, [this]() { emit metricsSnapshot(engine->metrics().snapshot()); });
 
-    if(error)
-        qCritical() << "Fingerprintreader not detected";
+    // Negotiated on a pool thread : construction returns at once, ready() tells when the link is known
+    startup = QtConcurrent::run([this]() { start(); });
+}
+
+SecugenSda04::~SecugenSda04()
+{
+    // Its replies come from the worker thread, still running
+    startup.waitForFinished();
+
+    if(autoOnPin >= 0)
+        triggers[autoOnPin].testAndSetOrdered(&trigger, 0);
+
+    workerThread.quit();
+    workerThread.wait();
 }
 
 void SecugenSda04::autoOn() {
@@ -35,41 +85,258 @@ void SecugenSda04::autoOn() {
     emit fingerDetected();
 }
 
+void SecugenSda04::setAutoIdentify(bool enabled, int debounce)
+{
+    touchDebounce = debounce;
+
+    // Direct : the interrupt thread submits the identify itself, no event loop in between
+    if(enabled)
+        connect(&trigger, &Trigger::triggered, this, &SecugenSda04::touched, static_cast<Qt::ConnectionType>(Qt::DirectConnection | Qt::UniqueConnection));
+    else
+        disconnect(&trigger, &Trigger::triggered, this, &SecugenSda04::touched);
+}
+
+void SecugenSda04::touched()
+{
+    // Interrupt thread
+    const qint64 touchAt = touchClock.nsecsElapsed();
+    const qint64 now = touchAt / 1000000;
+
+    if(now - lastTouch.load() < touchDebounce.load())
+        return;
+    lastTouch = now;
+
+    // One result per touch
+    if(!identifying.testAndSetOrdered(0, 1))
+        return;
+
+    engine->post(Sda04Command(0x56), [this, touchAt](Sda04Reply *reply) {
+        QVariant result = SecugenSda04::decodeIdentify(reply);
+        int userID = result.toInt();
+        qint64 latency = touchClock.nsecsElapsed() - touchAt;
+
+        engine->recordTouch(latency);
+        qDebug() << "Touch to decision in " << latency / 1000000 << " ms";
+
+        if(userID > 0)
+            emit identified(userID);
+        else if(userID == -1 || userID == -2)
+            emit unknownFinger();
+        else
+            emit identifyFailed(userID);
+
+        identifying = 0;
+
+        return result;
+    });
+}
+
 void SecugenSda04::setSerialPort(qint32 baudRate)
 {
-    if(!serial.isOpen())
+    QMetaObject::invokeMethod(engine, "setSerialPort", Qt::BlockingQueuedConnection, Q_ARG(qint32, baudRate));
+}
+
+bool SecugenSda04::openSession(qint32 baudRate)
+{
+    bool ok = false;
+    QMetaObject::invokeMethod(engine, "openSession", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ok), Q_ARG(qint32, baudRate));
+
+    return ok;
+}
+
+void SecugenSda04::closeSession()
+{
+    QMetaObject::invokeMethod(engine, "closeSession", Qt::BlockingQueuedConnection);
+}
+
+bool SecugenSda04::reconnect()
+{
+    bool ok = false;
+    QMetaObject::invokeMethod(engine, "reconnect", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, ok));
+
+    return ok;
+}
+
+bool SecugenSda04::isSessionOpen() const
+{
+    bool open = false;
+    QMetaObject::invokeMethod(engine, "isSessionOpen", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, open));
+
+    return open;
+}
+
+Sda04Engine::QueueStats SecugenSda04::queueStats(int priority) const
+{
+    return engine->queueStats(priority);
+}
+
+const Sda04Metrics &SecugenSda04::metrics() const
+{
+    return engine->metrics();
+}
+
+void SecugenSda04::setMetricsInterval(int msecs)
+{
+    if(msecs > 0)
+        metricsTimer.start(msecs);
+    else
+        metricsTimer.stop();
+}
+
+bool SecugenSda04::startRecording(const QString &fileName)
+{
+    bool started = false;
+    QMetaObject::invokeMethod(engine, "startRecording", Qt::BlockingQueuedConnection, Q_RETURN_ARG(bool, started), Q_ARG(QString, fileName));
+
+    return started;
+}
+
+void SecugenSda04::stopRecording()
+{
+    QMetaObject::invokeMethod(engine, "stopRecording", Qt::BlockingQueuedConnection);
+}
+
+void SecugenSda04::setAckTimeout(int commandClass, int msecs)
+{
+    engine->setAckTimeout(commandClass, msecs);
+}
+
+qint32 SecugenSda04::negotiateBaudRate(qint32 maxBaudRate)
+{
+    static const qint32 rates[] = { QSerialPort::Baud115200, QSerialPort::Baud57600, QSerialPort::Baud19200, QSerialPort::Baud9600 };
+
+    QSettings settings("gplaza", "addon-fingerprint-qt");
+    qint32 current = findBaudRate(settings.value(settingsKey(), QSerialPort::Baud9600).toInt());
+
+    if(current == 0)
     {
-        if (!serial.open(QIODevice::ReadWrite)) {
-            qCritical() << "error open : " << serial.errorString() << "(code : " << serial.error() << ")";
-        }
+        qCritical() << "No answer from the reader at any speed";
+        return 0;
     }
 
-    if (!serial.setBaudRate(baudRate)) {
-        qCritical() << "Can't set baud rate " << baudRate << " baud to port " << serialPort << ", error code " << serial.error();
-    }
+    // Fastest speed first, one step down each time the reader can't be heard at the new one
+    for(uint i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        qint32 rate = rates[i];
 
-    if (!serial.setDataBits(QSerialPort::Data8)) {
-        qCritical() << "Can't set 8 data bits to port " << serialPort << ", error code " << serial.error();
-    }
+        if(rate > maxBaudRate)
+            continue;
+        if(rate == current)
+            break;
+
+        // Sent at the current speed, the reader answers at the new one
+        Sda04Reply *reply = engine->submit(Sda04Command(0x21, Sda04Engine::baudRateCode(rate), 0x0000, 0, QByteArray(), current));
+        reply->waitForFinished();
+        bool sent = !reply->timedOut();
+        delete reply;
+
+        if(sent && probeBaudRate(rate)) {
+            current = rate;
+            break;
+        }
+
+        qWarning() << "Reader doesn't answer at " << rate << " bauds, falling back";
+
+        // The speed change may or may not have been applied
+        current = findBaudRate(current);
+
+        if(current == 0)
+        {
+            qCritical() << "Reader lost during speed negotiation";
+            return 0;
+        }
 
-    if (!serial.setParity(QSerialPort::NoParity)) {
-        qCritical() << "Can't set no parity to port " << serialPort << ", error code " << serial.error();
+        if(current == rate)
+            break;
     }
 
-    if (!serial.setStopBits(QSerialPort::OneStop)) {
-        qCritical() << "Can't set 1 stop bit to port " << serialPort << ", error code " << serial.error();
+    settings.setValue(settingsKey(), current);
+    qDebug() << "Reader link at " << current << " bauds";
+
+    return current;
+}
+
+void SecugenSda04::start()
+{
+    // Reader found at its last known speed, then moved to the fastest one
+    error = (negotiateBaudRate() == 0);
+
+    if(error)
+        qCritical() << "Fingerprintreader not detected";
+
+    // Held commands run even without a reader, they end in timeouts like before
+    engine->setLinkReady(true);
+
+    emit ready(!error);
+}
+
+bool SecugenSda04::isReady() const
+{
+    return startup.isFinished();
+}
+
+void SecugenSda04::waitForReady()
+{
+    startup.waitForFinished();
+}
+
+qint32 SecugenSda04::baudRate() const
+{
+    qint32 rate = 0;
+    QMetaObject::invokeMethod(engine, "baudRate", Qt::BlockingQueuedConnection, Q_RETURN_ARG(qint32, rate));
+
+    return rate;
+}
+
+bool SecugenSda04::probeBaudRate(qint32 baudRate)
+{
+    for(int attempt = 0; attempt < PROBE_RETRIES; attempt++)
+    {
+        // Status request, any well formed ACK proves the speed
+        Sda04Command status(0x30, 0x0004, 0x0000, 0, QByteArray(), baudRate);
+        status.timeout = PROBE_TIMEOUT;
+
+        Sda04Reply *reply = engine->submit(status);
+        reply->waitForFinished();
+        bool answered = !reply->timedOut() && reply->error() >= 0 && reply->error() != SecugenSda04::ERROR_CHECKSUM_ERROR;
+        delete reply;
+
+        if(answered)
+        {
+            QMetaObject::invokeMethod(engine, "setBaudRate", Qt::BlockingQueuedConnection, Q_ARG(qint32, baudRate));
+            return true;
+        }
     }
 
-    if (!serial.setFlowControl(QSerialPort::NoFlowControl)) {
-        qCritical() << "Can't set no flow control to port " << serialPort << ", error code " << serial.error();
+    return false;
+}
+
+qint32 SecugenSda04::findBaudRate(qint32 preferred)
+{
+    // Last known speed, then the power up one, then the others
+    QList<qint32> rates;
+    rates << preferred << QSerialPort::Baud9600 << QSerialPort::Baud115200 << QSerialPort::Baud57600 << QSerialPort::Baud19200;
+
+    for(int i = 0; i < rates.size(); i++)
+    {
+        if(rates.indexOf(rates.at(i)) != i || Sda04Engine::baudRateCode(rates.at(i)) == 0)
+            continue;
+
+        if(probeBaudRate(rates.at(i)))
+            return rates.at(i);
     }
 
-    serial.clearError();
+    return 0;
+}
+
+QString SecugenSda04::settingsKey() const
+{
+    return "sda04/" + QString(serialPort).replace('/', '_') + "/baudRate";
 }
 
 void SecugenSda04::waitForFinger()
 {
-    QObject::connect(&trigger, &Trigger::triggered, this, &SecugenSda04::autoOn);
+    QObject::connect(&trigger, &Trigger::triggered, this, &SecugenSda04::autoOn, Qt::UniqueConnection);
 }
 
 void SecugenSda04::stopWaitForFinger()
@@ -79,435 +346,928 @@ void SecugenSda04::stopWaitForFinger()
 
 int SecugenSda04::getuserIDavailable()
 {
-    QList<int> ids;
-    int i = 1;
-    ids = getuserIDs();
+    // The device is only read the first time, the index follows the changes made here
+    if(!userIndex.isLoaded())
+        syncUserIndex();
 
-    while(i <= 9999)
-    {
-        if(ids.contains(i))
-            i++;
-        else
-            break;
-    }
+    int i = userIndex.firstFree();
 
     qDebug() << "New ID for fingerprint : "  << i;
 
     return i;
 }
 
+int SecugenSda04::reserveUserID()
+{
+    if(!userIndex.isLoaded())
+        syncUserIndex();
+
+    return userIndex.reserve();
+}
+
+void SecugenSda04::releaseUserID(int userID)
+{
+    userIndex.release(userID);
+}
+
+bool SecugenSda04::isUserIndexLoaded() const
+{
+    return userIndex.isLoaded();
+}
+
+bool SecugenSda04::syncUserIndex()
+{
+    getuserIDs();
+
+    return userIndex.isLoaded();
+}
+
+bool SecugenSda04::verifyUserIndex()
+{
+    QList<int> indexed = userIndex.ids();
+    bool loaded = userIndex.isLoaded();
+
+    // Reloads the index from the device
+    if(!syncUserIndex())
+        return false;
+
+    if(!loaded || indexed != userIndex.ids())
+    {
+        qWarning() << "User index out of sync with the reader, reloaded";
+        return false;
+    }
+
+    return true;
+}
+
 QList<int> SecugenSda04::getuserIDs()
 {
-    DataContainer dataContainer;
-    QByteArray data;
-    QString u;
-    QSet<int> ids;
-    int id;
-    bool ok;
-    QList<int> list;
+    return waitResult(getuserIDsAsync()).value<QList<int> >();
+}
+
+Sda04Reply *SecugenSda04::getuserIDsAsync()
+{
+    return engine->submit(Sda04Command(0x7d,0x0001), [this](Sda04Reply *reply) {
+        QVariant ids = SecugenSda04::decodeUserIDs(reply);
+
+        // Only a complete answer describes the database
+        if(reply->error() == SecugenSda04::ERROR_NONE || reply->error() == SecugenSda04::ERROR_DB_NO_DATA)
+            userIndex.load(ids.value<QList<int> >());
+
+        return ids;
+    }, Sda04Engine::PRIORITY_ENROLLMENT);
+}
 
-    executeCommand(0x7d,dataContainer,0x00,0x01);
+QVariant SecugenSda04::decodeUserIDs(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+    QByteArray data = reply->packet();
+    Sda04UserIndex ids;
+    QList<int> list;
 
-    QString numberIDs = dataContainer.param1();
-    uint sizeID = numberIDs.toUInt(&ok,16);
+    uint sizeID = ack.param1();
 
-    if(dataContainer.error() == SecugenSda04::ERROR_DB_NO_DATA)
+    if(ack.error() == SecugenSda04::ERROR_DB_NO_DATA)
         qDebug() << "ID Empty";
     else {
 
         qDebug() << "Number of ID : " << QString::number(sizeID);
 
-        data = dataContainer.packet();
-        int i = 0;
+        // One 12 bytes record per user, the ID in its first two bytes
+        sizeID = qMin<uint>(sizeID, data.size() / 12);
+        const uchar *record = reinterpret_cast<const uchar*>(data.constData());
 
-        for(uint j = 0; j < sizeID; j++)
-        {
-            QString hVal = (QString::number(data[i+1], 16).length() == 1)? ("0" + QString::number(data[i+1], 16)) : QString::number(data[i+1], 16);
-            QString lVal = (QString::number(data[i+0], 16).length() == 1)? ("0" + QString::number(data[i+0], 16)) : QString::number(data[i+0], 16);
+        for(uint j = 0; j < sizeID; j++, record += 12)
+            ids.insert(Sda04Ack::fromBcd(record[0] | (record[1] << 8)));
 
-            u = hVal + lVal;
-            id = u.toInt(&ok,10);
+        // Sorted and without duplicates
+        list = ids.ids();
+    }
 
-            ids.insert(id);
-            i = i + 12;
-        }
+    return QVariant::fromValue(list);
+}
 
-        list = QList<int>::fromSet(ids);
-        qSort(list);
-    }
+int SecugenSda04::registerUser(const QString &hash, int userID, bool replace, int format)
+{
+    return waitResult(registerUserAsync(hash, userID, replace, format)).toInt();
+}
 
-    return list;
+Sda04Reply *SecugenSda04::registerUserAsync(const QString &hash, int userID, bool replace, int format, int priority)
+{
+    return putTemplateAsync(QByteArray::fromBase64(hash.toLatin1()), userID, replace, format, priority);
+}
+
+int SecugenSda04::putTemplate(int userID, const QByteArray &templates, bool replace, int format)
+{
+    return waitResult(putTemplateAsync(templates, userID, replace, format)).toInt();
 }
 
-int SecugenSda04::integerFromArray(QByteArray array, int start, int lenght)
+Sda04Reply *SecugenSda04::putTemplateAsync(const QByteArray &binHash, int userID, bool replace, int format, int priority)
 {
-    int num = 0;
-    QByteArray cut = array.mid(start,lenght);
-    bool ok;
+    QByteArray newFingerprint(Sda04TemplateStore::recordSize(format), 0x00);
 
-    if(lenght==1)
+    qDebug() << "Hash detail :";
+    qDebug() << "Format : " << (format == SecugenSda04::ANSI378? "ANSI:378" : "SG400");
+    qDebug() << "Size total hash : " << binHash.size();
+    qDebug() << "Size minutiae data to create : " << newFingerprint.size();
+
+    // A malformed template never reaches the reader
+    Sda04Template::Error invalid = Sda04Template::validate(binHash, format);
+    if(invalid != Sda04Template::TEMPLATE_VALID || !Sda04TemplateStore::buildRecord(newFingerprint.data(), userID, binHash, format))
     {
-        num = QString::number(cut[0], 16).toUInt(&ok,16);
+        qWarning() << "Malformed template for user " << userID << " : " << Sda04Template::errorString(invalid);
+        return engine->reject(Sda04Command(0x71), SecugenSda04::ERROR_INVALID_FPRECORD, &SecugenSda04::decodeRegisterUser);
+    }
 
-    } else {
+    return registerRecordAsync(newFingerprint, replace, priority);
+}
 
-        QString hg = QString::number(cut[0], 16).right(2);
-        QString lo = QString::number(cut[1], 16).right(2);
+Sda04Reply *SecugenSda04::registerRecordAsync(const QByteArray &record, bool replace, int priority)
+{
+    const int userID = Sda04Ack::fromBcd((uchar)record[0] | ((uchar)record[1] << 8));
 
-        lo = lo.length() == 1? "0" + lo:lo;
-        num = (hg + lo).toUInt(&ok,16);
-    }
+    // Parameters : replace flag, record size as extra data
+    const quint16 change = replace? 0x0001 : 0x0000;
 
-    return (!ok)? 0 : num;
+    return engine->submit(Sda04Command(0x71,change,0x0000,record.size(),record), [this, userID](Sda04Reply *reply) {
+        QVariant result = SecugenSda04::decodeRegisterUser(reply);
+        if(reply->error() == SecugenSda04::ERROR_NONE)
+            userIndex.insert(userID);
+        return result;
+    }, priority);
 }
 
-int SecugenSda04::registerUser(QString hash, int userID, bool replace, int format)
+int SecugenSda04::exportUser(int userID, Sda04TemplateStore &store)
 {
-    QByteArray binHash;
-    binHash.append(hash);
-    binHash = QByteArray::fromBase64(binHash);
+    Sda04Reply *reply = engine->submit(Sda04Command(0x73,userParam(userID)), Sda04Reply::Decoder(), Sda04Engine::PRIORITY_BULK);
+    reply->waitForFinished();
 
-    int sizeM = (format == SecugenSda04::ANSI378)? 800 : 400;
+    QByteArray templates = reply->takePacket();
+    delete reply;
 
-    int sizeFingerprint = 2 + 2 + (sizeM * 2) + 11 + 1;
-    QByteArray newFingerprint;
-    newFingerprint.resize(sizeFingerprint);
+    if(templates.isEmpty())
+        return -1;
 
-    std::vector<int> hexs = intToHex(userID);
-    // User ID :
-    newFingerprint[0] = hexs[0];
-    newFingerprint[1] = hexs[1];
-    // Master :
-    newFingerprint[2] = 0x00;
-    newFingerprint[3] = 0x00;
+    // Written straight into the mapped slot
+    return store.setTemplates(userID, templates)? 0 : -2;
+}
 
-    // Check number of template :
-    int sizeTotal = binHash.size();
+int SecugenSda04::importUser(int userID, const Sda04TemplateStore &store, bool replace)
+{
+    if(!store.contains(userID))
+        return -3;
 
-    qDebug() << "Hash detail :";
-    qDebug() << "Format : " << (format == SecugenSda04::ANSI378? "ANSI:378" : "SG400");
-    qDebug() << "Size total hash : " << sizeTotal;
-    qDebug() << "Size minutiae data to create : " << sizeFingerprint;
+    // The mapped record is the 0x71 payload : no copy before the serial write
+    return waitResult(registerRecordAsync(store.record(userID), replace)).toInt();
+}
 
-    if(format == SecugenSda04::ANSI378)
+int SecugenSda04::syncTemplates(Sda04TemplateStore &store, const QString &checkpointFile, bool removeExtra)
+{
+    Sda04SyncCheckpoint checkpoint(checkpointFile);
+
+    if(!store.isOpen() || !checkpoint.open())
+        return -1;
+
+    // Every command of the sync goes out on the same open port
+    bool wasOpen = isSessionOpen();
+    if(!wasOpen)
+        openSession();
+
+    Sda04Reply *reply = getuserIDsAsync();
+    reply->waitForFinished();
+    bool listed = (reply->error() == SecugenSda04::ERROR_NONE || reply->error() == SecugenSda04::ERROR_DB_NO_DATA);
+    Sda04UserIndex onDevice;
+    onDevice.load(reply->result().value<QList<int> >());
+    delete reply;
+
+    if(!listed)
     {
-        int sizeT1 = integerFromArray(binHash,8);
+        qCritical() << "Template sync : can't read the reader database";
+        if(!wasOpen)
+            closeSession();
+        return -2;
+    }
 
-        QByteArray t1;
-        QByteArray t2;
-        int sizeT2;
+    QList<int> missing;
+    QList<int> unknown;
+    QList<int> extra;
+    QList<int> storeIds = store.ids();
 
-        if(sizeTotal == sizeT1)
-        {
-            qDebug() << "Number of template : 1";
+    foreach(int userID, storeIds)
+    {
+        quint32 known = checkpoint.digest(userID);
+
+        if(!onDevice.contains(userID))
+            missing.append(userID);
+        else if(known == 0)
+            unknown.append(userID);
+        else if(known != store.digest(userID))
+            missing.append(userID);
+    }
 
-            t1 = binHash.left(sizeT1);
-            t2 = binHash.left(sizeT1);
-            sizeT2 = sizeT1;
+    if(removeExtra)
+    {
+        foreach(int userID, onDevice.ids())
+            if(!store.contains(userID))
+                extra.append(userID);
+    }
 
-            qDebug() << "Size template T1 : " << sizeT1;
+    qDebug() << "Template sync :" << missing.size() << "to write," << unknown.size() << "to compare," << extra.size() << "to remove";
 
-        } else { // 2 template
+    int progress = 0;
+    int total = missing.size() + unknown.size() + extra.size();
+    int written = 0;
+    QByteArray record(store.recordSize(), 0x00);
 
-            qDebug() << "Number of template : 2";
+    // Records on both sides never seen by this checkpoint : read back once, written only if they differ
+    bool ok = pipeline(unknown, [this](int userID) {
+        return getTemplateAsync(userID);
+    }, [&](int userID, Sda04Reply *reply) {
+        quint32 digest = 0;
+        QByteArray templates = reply->result().toByteArray();
 
-            t1 = binHash.left(sizeT1);
-            t2 = binHash.right(sizeTotal-sizeT1);
-            sizeT2 = integerFromArray(t2,8);
+        if(!templates.isEmpty() && Sda04TemplateStore::buildRecord(record.data(), userID, templates, store.format()))
+            digest = Sda04TemplateStore::recordDigest(record.constData(), record.size());
 
-            qDebug() << "Size template T1 : " << sizeT1;
-            qDebug() << "Size template T2 : " << sizeT2;
+        if(digest == store.digest(userID))
+            checkpoint.setDigest(userID, digest);
+        else {
+            missing.append(userID);
+            total++;
         }
+    }, progress, total);
+
+    // Writes are streamed from the mapped store, the confirmed ones are checkpointed at once
+    ok = ok && pipeline(missing, [this, &store, &onDevice](int userID) {
+        return registerRecordAsync(store.record(userID), onDevice.contains(userID));
+    }, [&](int userID, Sda04Reply *reply) {
+        if(reply->error() == SecugenSda04::ERROR_NONE) {
+            checkpoint.setDigest(userID, store.digest(userID));
+            written++;
+        } else {
+            checkpoint.setDigest(userID, 0);
+            qWarning() << "Template sync : user " << userID << " rejected, error " << reply->error();
+        }
+    }, progress, total);
+
+    ok = ok && pipeline(extra, [this](int userID) {
+        return deleteUserAsync(userID);
+    }, [&](int userID, Sda04Reply *reply) {
+        if(reply->error() == SecugenSda04::ERROR_NONE || reply->error() == SecugenSda04::ERROR_USER_NOT_FOUND)
+            checkpoint.setDigest(userID, 0);
+    }, progress, total);
+
+    if(!wasOpen)
+        closeSession();
+
+    if(!ok)
+    {
+        qCritical() << "Template sync interrupted after " << written << " records";
+        return -2;
+    }
+
+    emit partialComplete(100);
+
+    return written;
+}
+
+int SecugenSda04::backup(const QString &archiveFile, const QString &previousArchive, int format)
+{
+    Sda04ArchiveReader previous(previousArchive);
+    bool incremental = !previousArchive.isEmpty() && previous.open() && previous.format() == format;
 
-        newFingerprint.replace(4,sizeT1,t1);
+    if(!previousArchive.isEmpty() && !incremental)
+        qWarning() << "Backup : previous archive " << previousArchive << " not usable, full backup";
 
-        for(int i = sizeT1 + 4;i<= 1600 + 4;i++)
-            newFingerprint[i] = 0x00;
+    Sda04ArchiveWriter archive(archiveFile);
+    if(!archive.open(format))
+        return -1;
 
-        newFingerprint.replace(800 + 4,sizeT2,t2);
+    // Every command of the backup goes out on the same open port
+    bool wasOpen = isSessionOpen();
+    if(!wasOpen)
+        openSession();
 
-        for(int i = 1600 + 4;i< sizeFingerprint;i++)
-            newFingerprint[i] = 0xFF;
+    // The 0x7d directory : one 12 bytes entry per user, kept in the archive with the templates
+    Sda04Reply *reply = getuserIDsAsync();
+    reply->waitForFinished();
+    bool listed = (reply->error() == SecugenSda04::ERROR_NONE || reply->error() == SecugenSda04::ERROR_DB_NO_DATA);
+    QByteArray directory = (reply->error() == SecugenSda04::ERROR_NONE)? reply->packet() : QByteArray();
+    const int size = qMin<int>(Sda04Ack(reply->ack()).param1(), directory.size() / Sda04Archive::DIRECTORY_SIZE);
+    delete reply;
 
+    if(!listed)
+    {
+        qCritical() << "Backup : can't read the reader database";
+        if(!wasOpen)
+            closeSession();
+        return -2;
     }
 
-    if(format == SecugenSda04::SG400)
+    QHash<int, const char *> entries;
+    QList<int> fetch;
+    int copied = 0;
+
+    for(int i = 0; i < size; i++)
     {
-        newFingerprint.replace(4,sizeTotal,binHash);
+        const char *entry = directory.constData() + i * Sda04Archive::DIRECTORY_SIZE;
+        int userID = Sda04Ack::fromBcd((uchar)entry[0] | ((uchar)entry[1] << 8));
+
+        if(userID < 1 || entries.contains(userID))
+            continue;
+        entries.insert(userID, entry);
 
-        for(int i = 800 + 4;i< sizeFingerprint;i++)
-            newFingerprint[i] = 0xFF;
+        // Presence only : the entry carries the ID and nothing that changes with the templates
+        if(incremental && previous.contains(userID) && previous.verify(userID)) {
+            archive.write(userID, entry, previous.templates(userID));
+            copied++;
+        } else {
+            fetch.append(userID);
+        }
     }
 
-    // Parameters :
-    const char sizeParam2L = (format == SecugenSda04::ANSI378)? 0x06 : 0x03;
-    const char sizeParam2H = (format == SecugenSda04::ANSI378)? 0x50 : 0x30;
-    const char change = replace? 0x01 : 0x00;
+    int progress = 0;
+    int total = fetch.size();
 
-    DataContainer dataContainer;
-    executeCommand(0x71,dataContainer,0x00,change,0x00,0x00,sizeParam2L,sizeParam2H,0x00,0x00,newFingerprint,QSerialPort::Baud57600);
+    // Streamed : each template goes to the archive as soon as it's read
+    bool ok = pipeline(fetch, [this](int userID) {
+        return getTemplateAsync(userID);
+    }, [&](int userID, Sda04Reply *reply) {
+        QByteArray templates = reply->result().toByteArray();
 
-    if(dataContainer.error() == SecugenSda04::ERROR_INSUFFICIENT_DATA)
-        return -1;
-    if(dataContainer.error() == SecugenSda04::ERROR_INVALID_FPRECORD)
+        if(templates.isEmpty())
+            qWarning() << "Backup : no template for user " << userID << ", error " << reply->error();
+        else
+            archive.write(userID, entries.value(userID), templates);
+    }, progress, total);
+
+    if(!wasOpen)
+        closeSession();
+
+    // Not committed : the file keeps its previous content
+    if(!ok)
         return -2;
 
-    return 0;
+    if(!archive.commit())
+        return -1;
+
+    qDebug() << "Backup :" << archive.count() << "users," << copied << "copied from the previous archive";
+
+    return archive.count();
+}
+
+int SecugenSda04::restore(const QString &archiveFile, bool replace)
+{
+    Sda04ArchiveReader archive(archiveFile);
+    if(!archive.open())
+        return -1;
+
+    QList<int> ids;
+    foreach(int userID, archive.ids())
+    {
+        if(archive.verify(userID))
+            ids.append(userID);
+        else
+            qWarning() << "Restore : templates of user " << userID << " corrupted, skipped";
+    }
+
+    bool wasOpen = isSessionOpen();
+    if(!wasOpen)
+        openSession();
+
+    int progress = 0;
+    int total = ids.size();
+    int written = 0;
+
+    // Sent from the mapped archive
+    bool ok = pipeline(ids, [this, &archive, replace](int userID) {
+        return putTemplateAsync(archive.templates(userID), userID, replace, archive.format());
+    }, [&](int userID, Sda04Reply *reply) {
+        if(reply->error() == SecugenSda04::ERROR_NONE)
+            written++;
+        else
+            qWarning() << "Restore : user " << userID << " rejected, error " << reply->error();
+    }, progress, total);
+
+    if(!wasOpen)
+        closeSession();
+
+    return ok? written : -2;
+}
+
+bool SecugenSda04::pipeline(const QList<int> &ids, std::function<Sda04Reply *(int)> submit, std::function<void (int, Sda04Reply *)> done, int &progress, const int &total)
+{
+    QQueue<QPair<int, Sda04Reply *> > inFlight;
+    int next = 0;
+    bool ok = true;
+
+    // A few commands stay queued : the next one leaves as soon as the reader answers the previous one
+    while(next < ids.size() || !inFlight.isEmpty())
+    {
+        while(ok && next < ids.size() && inFlight.size() < SYNC_WINDOW)
+        {
+            int userID = ids.at(next++);
+            inFlight.enqueue(qMakePair(userID, submit(userID)));
+        }
+
+        if(inFlight.isEmpty())
+            break;
+
+        QPair<int, Sda04Reply *> head = inFlight.dequeue();
+        head.second->waitForFinished();
+
+        // Link lost : what is already queued drains, nothing new is sent.
+        // A plain timeout (busy reader, slow flash write) only fails that user.
+        if(head.second->linkLost()) {
+            ok = false;
+        } else {
+            if(head.second->timedOut())
+                qWarning() << "No answer from the reader for user " << head.first;
+            done(head.first, head.second);
+        }
+
+        delete head.second;
+
+        if(total > 0)
+            emit partialComplete(++progress * 100 / total);
+    }
+
+    return ok;
+}
+
+QVariant SecugenSda04::decodeRegisterUser(Sda04Reply *reply)
+{
+    // Also set when the record was refused before being sent
+    if(reply->error() == SecugenSda04::ERROR_INSUFFICIENT_DATA)
+        return QVariant(-1);
+    if(reply->error() == SecugenSda04::ERROR_INVALID_FPRECORD)
+        return QVariant(-2);
+    // No ACK (timeout) or a corrupted one : not a success
+    if(reply->timedOut() || reply->error() < 0 || reply->error() == SecugenSda04::ERROR_CHECKSUM_ERROR)
+        return QVariant(-3);
+
+    return QVariant(0);
 }
 
 int SecugenSda04::registerNewUserStart(int userID)
 {
-    DataContainer dataContainer;
-    std::vector<int> hexs = intToHex(userID);
-    executeCommand(0x50,dataContainer,hexs[1],hexs[0]);
+    return waitResult(registerNewUserStartAsync(userID)).toInt();
+}
 
-    if(dataContainer.error() == SecugenSda04::ERROR_TIMEOUT)
-        return 1;
-    if(dataContainer.error() == SecugenSda04::ERROR_DB_FULL)
-        return 2;
-    if(dataContainer.error() == SecugenSda04::ERROR_ALREADY_REGISTERED_USER)
-        return 3;
+Sda04Reply *SecugenSda04::registerNewUserStartAsync(int userID)
+{
+    return engine->submit(Sda04Command(0x50,userParam(userID)), &SecugenSda04::decodeRegisterStart, Sda04Engine::PRIORITY_ENROLLMENT);
+}
 
-    return 0;
+Sda04Quality SecugenSda04::captureChecked(QByteArray &img, int attempts, int imageSize)
+{
+    Sda04Quality best;
+    img.clear();
+
+    for(int attempt = 0; attempt < attempts && !best.accepted(); attempt++)
+    {
+        QByteArray capture = waitResult(getImageAsync(imageSize)).toByteArray();
+        Sda04Quality quality = Sda04Quality::assess(capture, imageSize);
+
+        qDebug() << "Capture quality : score" << quality.score() << "coverage" << quality.coverage()
+                 << "contrast" << quality.contrast() << "clarity" << quality.clarity();
+
+        if(!quality.isValid() || (best.isValid() && quality.score() <= best.score()))
+        {
+            releaseImage(capture);
+            continue;
+        }
+
+        // Best of the captures so far
+        releaseImage(img);
+        img = capture;
+        best = quality;
+    }
+
+    return best;
+}
+
+int SecugenSda04::registerNewUserStartWhenPlaced(int userID, int attempts)
+{
+    QByteArray img;
+    Sda04Quality quality = captureChecked(img, attempts);
+    releaseImage(img);
+
+    // Placement only : the reader captures again for the registration itself
+    if(!quality.accepted())
+        return 5;
+
+    return registerNewUserStart(userID);
+}
+
+int SecugenSda04::registerNewUserEndWhenPlaced(int userID, int attempts)
+{
+    QByteArray img;
+    Sda04Quality quality = captureChecked(img, attempts);
+    releaseImage(img);
+
+    if(!quality.accepted())
+        return 5;
+
+    return registerNewUserEnd(userID);
+}
+
+QVariant SecugenSda04::decodeRegisterStart(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+
+    // No ACK (timeout) or a corrupted one : not a success
+    if(reply->timedOut() || reply->error() < 0 || reply->error() == SecugenSda04::ERROR_CHECKSUM_ERROR)
+        return QVariant(-1);
+
+    if(ack.error() == SecugenSda04::ERROR_TIMEOUT)
+        return QVariant(1);
+    if(ack.error() == SecugenSda04::ERROR_DB_FULL)
+        return QVariant(2);
+    if(ack.error() == SecugenSda04::ERROR_ALREADY_REGISTERED_USER)
+        return QVariant(3);
+
+    return QVariant(0);
 }
 
 int SecugenSda04::registerNewUserEnd(int userID)
 {
-    DataContainer dataContainer;
-    std::vector<int> hexs = intToHex(userID);
-    executeCommand(0x51,dataContainer,hexs[1],hexs[0]);
+    return waitResult(registerNewUserEndAsync(userID)).toInt();
+}
 
-    if(dataContainer.error() == SecugenSda04::ERROR_TIMEOUT)
-        return 1;
-    if(dataContainer.error() == SecugenSda04::ERROR_REGISTER_FAILED)
-        return 2;
-    if(dataContainer.error() == SecugenSda04::ERROR_FLASH_WRITE_ERROR)
-        return 3;
-    if(dataContainer.error() == SecugenSda04::ERROR_USER_NOT_FOUND)
-        return 4;
+Sda04Reply *SecugenSda04::registerNewUserEndAsync(int userID)
+{
+    return engine->submit(Sda04Command(0x51,userParam(userID)), [this, userID](Sda04Reply *reply) {
+        QVariant result = SecugenSda04::decodeRegisterEnd(reply);
+        if(reply->error() == SecugenSda04::ERROR_NONE)
+            userIndex.insert(userID);
+        return result;
+    }, Sda04Engine::PRIORITY_ENROLLMENT);
+}
 
-    return 0;
+QVariant SecugenSda04::decodeRegisterEnd(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+
+    // No ACK (timeout) or a corrupted one : not a success
+    if(reply->timedOut() || reply->error() < 0 || reply->error() == SecugenSda04::ERROR_CHECKSUM_ERROR)
+        return QVariant(-1);
+
+    if(ack.error() == SecugenSda04::ERROR_TIMEOUT)
+        return QVariant(1);
+    if(ack.error() == SecugenSda04::ERROR_REGISTER_FAILED)
+        return QVariant(2);
+    if(ack.error() == SecugenSda04::ERROR_FLASH_WRITE_ERROR)
+        return QVariant(3);
+    if(ack.error() == SecugenSda04::ERROR_USER_NOT_FOUND)
+        return QVariant(4);
+
+    return QVariant(0);
 }
 
 int SecugenSda04::deleteUser(int userID) {
 
-    DataContainer dataContainer;
-    std::vector<int> hexs = intToHex(userID);
-    executeCommand(0x54,dataContainer,hexs[1],hexs[0]);
+    return waitResult(deleteUserAsync(userID)).toInt();
+}
 
-    if(dataContainer.error() == SecugenSda04::ERROR_USER_NOT_FOUND)
-        return 1;
-    if(dataContainer.error() == SecugenSda04::ERROR_FLASH_WRITE_ERROR)
-        return 2;
+Sda04Reply *SecugenSda04::deleteUserAsync(int userID)
+{
+    return engine->submit(Sda04Command(0x54,userParam(userID)), [this, userID](Sda04Reply *reply) {
+        QVariant result = SecugenSda04::decodeDelete(reply);
+        if(reply->error() == SecugenSda04::ERROR_NONE || reply->error() == SecugenSda04::ERROR_USER_NOT_FOUND)
+            userIndex.remove(userID);
+        return result;
+    }, Sda04Engine::PRIORITY_ENROLLMENT);
+}
 
-    return 0;
+QVariant SecugenSda04::decodeDelete(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+
+    // No ACK (timeout) or a corrupted one : not a success
+    if(reply->timedOut() || reply->error() < 0 || reply->error() == SecugenSda04::ERROR_CHECKSUM_ERROR)
+        return QVariant(-1);
+
+    if(ack.error() == SecugenSda04::ERROR_USER_NOT_FOUND)
+        return QVariant(1);
+    if(ack.error() == SecugenSda04::ERROR_FLASH_WRITE_ERROR)
+        return QVariant(2);
+
+    return QVariant(0);
 }
 
 int SecugenSda04::getHashUser(int userID, QString &hash64)
 {
-    DataContainer dataContainer;
-    std::vector<int> hexs = intToHex(userID);
-    executeCommand(0x73,dataContainer,hexs[1],hexs[0]);
-    QString tempHash;
+    QVariant hash = waitResult(getHashUserAsync(userID));
 
-    if(dataContainer.packetSize() > 0)
-    {
-        tempHash = dataContainer.packet().toBase64();
-        std::string hash = tempHash.toStdString();
-        hash64 = QString::fromStdString(hash);
+    if(hash.isNull())
+        return -1;
 
-        return 0;
+    hash64 = hash.toString();
 
-    } else {
+    return 0;
+}
+
+Sda04Reply *SecugenSda04::getHashUserAsync(int userID, int priority)
+{
+    return engine->submit(Sda04Command(0x73,userParam(userID)), &SecugenSda04::decodeHash, priority);
+}
+
+int SecugenSda04::getTemplate(int userID, QByteArray &templates)
+{
+    // Moved in : the engine holds the only reference and fills it without a copy
+    Sda04Reply *reply = getTemplateAsync(userID, Sda04Engine::PRIORITY_BULK, std::move(templates));
+    reply->waitForFinished();
+    QVariant result = reply->result();
+
+    if(result.isNull())
+    {
+        // The buffer goes back to the caller, empty, with the capacity it reserved
+        templates = reply->takePacket();
+        if(templates.isNull())
+            templates = reply->takeBuffer();
+        templates.resize(0);
+        delete reply;
 
         return -1;
     }
+
+    delete reply;
+    templates = result.toByteArray();
+
+    return 0;
+}
+
+Sda04Reply *SecugenSda04::getTemplateAsync(int userID, int priority, QByteArray buffer)
+{
+    // Received straight into the caller's buffer, no reallocation when its capacity is enough
+    Sda04Command command(0x73,userParam(userID));
+    command.packetBuffer = std::move(buffer);
+
+    return engine->submit(std::move(command), &SecugenSda04::decodeTemplate, priority);
+}
+
+QVariant SecugenSda04::decodeTemplate(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+
+    // Moved out of the reply : the result shares the received packet
+    if(ack.packetSize() > 0 && !reply->packet().isEmpty())
+        return QVariant(reply->takePacket());
+
+    return QVariant();
+}
+
+QVariant SecugenSda04::decodeHash(Sda04Reply *reply)
+{
+    QVariant templates = decodeTemplate(reply);
+
+    // Text only at the API boundary
+    if(templates.isNull())
+        return QVariant();
+
+    return QVariant(QString::fromLatin1(templates.toByteArray().toBase64()));
 }
 
 QVariant SecugenSda04::scanFinger()
 {
     qDebug() << "scanFinger";
 
-    DataContainer dataContainer;
-    executeCommand(0x56,dataContainer,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00);
+    return waitResult(scanFingerAsync());
+}
+
+Sda04Reply *SecugenSda04::scanFingerAsync(int timeout)
+{
+    Sda04Command command(0x56);
+    command.timeout = timeout;
+
+    return engine->submit(command, &SecugenSda04::decodeIdentify);
+}
 
-    if(dataContainer.error() == SecugenSda04::ERROR_USER_NOT_FOUND) // ??
+QVariant SecugenSda04::decodeIdentify(Sda04Reply *reply)
+{
+    Sda04Ack ack(reply->ack());
+
+    if(ack.error() == SecugenSda04::ERROR_USER_NOT_FOUND) // ??
         return QVariant(-1);
-    if(dataContainer.error() == SecugenSda04::ERROR_IDENTIFY_FAILED)
+    if(ack.error() == SecugenSda04::ERROR_IDENTIFY_FAILED)
         return QVariant(-2);
-    if(dataContainer.error() == SecugenSda04::ERROR_TIMEOUT)
+    if(ack.error() == SecugenSda04::ERROR_TIMEOUT)
+        return QVariant(-3);
+    // No ACK or a corrupted one : no identification
+    if(reply->error() < 0 || reply->error() == SecugenSda04::ERROR_CHECKSUM_ERROR)
         return QVariant(-3);
 
-    return QVariant(dataContainer.id());
+    return QVariant(ack.userId());
 }
 
 bool SecugenSda04::verifyFinger(int userID)
 {
-    DataContainer dataContainer;
-    std::vector<int> hexs = intToHex(userID);
-    executeCommand(0x55,dataContainer,hexs[1],hexs[0]);
-
-    return (dataContainer.error() == 0);
+    return waitResult(verifyFingerAsync(userID)).toBool();
 }
 
-int SecugenSda04::getImage(QByteArray &img, int imageSize)
+Sda04Reply *SecugenSda04::verifyFingerAsync(int userID, int timeout)
 {
-    QByteArray data;
-    QByteArray header;
-    DataContainer dataContainer;
-    QString headerHex;
+    Sda04Command command(0x55,userParam(userID));
+    command.timeout = timeout;
 
-    headerHex = (imageSize == SecugenSda04::IMAGE_FULL_SIZE)? HEADER_PICTURE_FULL_SIZE : HEADER_PICTURE_HALF_SIZE;
-    const char sizeCmd = (imageSize == SecugenSda04::IMAGE_FULL_SIZE)? 0x01 : 0x02;
+    return engine->submit(command, &SecugenSda04::decodeVerify);
+}
 
-    executeCommand(0x43,dataContainer,0x00,sizeCmd,0x00,0x00);
+QVariant SecugenSda04::decodeVerify(Sda04Reply *reply)
+{
+    // No ACK (timeout) is not a successful verification
+    return QVariant(reply->error() == SecugenSda04::ERROR_NONE);
+}
 
-    header = QByteArray::fromHex(headerHex.toLatin1());
-    data = dataContainer.packet();
+int SecugenSda04::getImage(QByteArray &img, int imageSize)
+{
+    Sda04Reply *reply = getImageAsync(imageSize);
+    reply->waitForFinished();
+    img = reply->result().toByteArray();
+    int error = reply->error();
+    delete reply;
 
-    if(imageSize == SecugenSda04::IMAGE_HALF_SIZE)
+    if(error != SecugenSda04::ERROR_NONE)
     {
-        char *imageByte = data.data();
-        char *tempData = new char[19800];
-
-        for(int i=0 ; i<150 ; i++)
-            memcpy(tempData+(150-i-1)*132, imageByte+i*130, 130);
-
-        data = QByteArray::fromRawData(tempData,19800);
+        qWarning() << "Image capture failed, error " << error;
+        return error;
     }
 
-    img = header + data;
-
-    qDebug() << "Header image size : " << header.size();
-    qDebug() << "Raw image size    : " << data.size();
-    qDebug() << "Image size        : " << img.size();
-
-    //QFile file("/home/pi/client-timer/test00.bmp");
-    //file.open(QIODevice::WriteOnly);
-    //file.write(img);
-    //file.close();
-
-    // TODO: error reader
+    // Answered, but not with an image of the requested size
+    if(img.isEmpty())
+        return -2;
 
     return 0;
 }
 
-void SecugenSda04::executeCommand(const char cmd, DataContainer &dataContainer, const char param1Hight, const char param1Low, const char param2Hight, const char param2Low ,const char lwExtraDataHight,const char lwExtraDataLow,const char hwExtraDataHight,const char hwExtraDataLow, QByteArray data, quint32 baudRate)
+// Future of getImageEncoded(), finished however its command ends : a reply completed without its decoder
+// (cancelled, dropped with the engine) releases the last reference and finishes it with an empty image
+struct Sda04ImagePromise
 {
-    setSerialPort(baudRate);
-#ifdef QT_DEBUG
-    qDebug() << "Serial configured to" << QString::number(serial.baudRate()) << "bauds";
-#endif
-    const char channel = 0x00;
-    const char stub = 0x00;
+    Sda04ImagePromise() : reply(0), cancelling(false) { promise.reportStarted(); }
+    ~Sda04ImagePromise() { finish(QByteArray()); }
 
-    int cks = ((int)cmd + (int)param1Hight + (int)param1Low + (int)param2Hight + (int)param2Low +(int)lwExtraDataLow + (int)lwExtraDataHight + (int)hwExtraDataLow + (int)hwExtraDataHight) % 256;
-    unsigned char buf[12];
+    void finish(const QByteArray &image)
+    {
+        if(promise.isFinished())
+            return;
+        promise.reportResult(image);
+        promise.reportFinished();
+    }
 
-    buf[0] = channel;
-    buf[1] = cmd;
-    buf[2] = param1Low;
-    buf[3] = param1Hight;
-    buf[4] = param2Low;
-    buf[5] = param2Hight;
-    buf[6] = lwExtraDataLow;
-    buf[7] = lwExtraDataHight;
-    buf[8] = hwExtraDataLow;
-    buf[9] = hwExtraDataHight;
-    buf[10] = stub;
-    buf[11] = cks;
+    QFutureInterface<QByteArray> promise;
+    Sda04Reply *reply; // engine thread only, while the command runs
+    bool cancelling;
+};
 
-    QByteArray databuf = QByteArray(reinterpret_cast<char*>(buf), 12);
-    serial.write(databuf);
+QFuture<QByteArray> SecugenSda04::getImageEncoded(int format, int imageSize)
+{
+    // Owned by the reply's handlers, and by the encoding job once it starts
+    QSharedPointer<Sda04ImagePromise> image(new Sda04ImagePromise());
+    Sda04Engine *engine = this->engine;
+
+    const quint16 sizeCmd = (imageSize == SecugenSda04::IMAGE_FULL_SIZE)? 0x0001 : 0x0002;
+    Sda04Command command(0x43,sizeCmd);
+
+    // QFuture::cancel() stops the transfer once the reader starts sending the image
+    auto cancelled = [image, engine]() {
+        if(!image->promise.isCanceled())
+            return false;
+        if(!image->cancelling) {
+            image->cancelling = true;
+            engine->cancel(image->reply);
+        }
+        return true;
+    };
+    auto setup = [image](Sda04Reply *reply) { image->reply = reply; };
 
-    if(!data.isEmpty())
-        serial.write(data.constData(),data.size());
+    if(format == SecugenSda04::IMAGE_BMP)
+    {
+        command.packetBuffer = imagePool.acquire(imageSize);
+        command.packetOffset = Sda04Bitmap::HEADER_SIZE;
+        command.chunkHandler = [cancelled](const char *, qint64, qint64) { cancelled(); };
 
-    if (serial.waitForBytesWritten(1000) && cmd != 0x21) {
+        engine->post(std::move(command), [imageSize, image](Sda04Reply *reply) {
+            // A BMP once its rows are in place : nothing to encode
+            image->finish(SecugenSda04::decodeImage(reply, imageSize).toByteArray());
+            return QVariant();
+        }, Sda04Engine::PRIORITY_ENROLLMENT, setup);
 
-        QByteArray ack;
-        int i = 0;
+        return image->promise.future();
+    }
 
-        while(ack.size() < 12 && i < timeoutSerial)
-        {
-            if(serial.waitForReadyRead(1000))
-                ack += serial.readAll();
-            i++;
+    // Rows go straight to the image as they arrive, no BMP is built
+    QSharedPointer<QImage> pixels(new QImage(Sda04Bitmap::width(imageSize), Sda04Bitmap::height(imageSize), QImage::Format_Grayscale8));
+    command.chunkHandler = [pixels, imageSize, cancelled](const char *data, qint64 offset, qint64 size) {
+        if(!cancelled())
+            Sda04Bitmap::copyRaw(*pixels, imageSize, data, offset, size);
+    };
+
+    engine->post(std::move(command), [pixels, imageSize, image](Sda04Reply *reply) {
+        bool complete = reply->error() == SecugenSda04::ERROR_NONE && reply->packet().size() == Sda04Bitmap::rawSize(imageSize);
+
+        if(!complete || image->promise.isCanceled()) {
+            image->finish(QByteArray());
+            return QVariant();
         }
 
-        if(i == timeoutSerial) {
+        // Compression off the serial thread
+        QtConcurrent::run([pixels, image]() {
+            image->finish(Sda04Bitmap::encode(*pixels, "png"));
+        });
 
-            error = true;
-            qCritical() << "serial timeout error";
+        return QVariant();
+    }, Sda04Engine::PRIORITY_ENROLLMENT, setup);
 
-        } else {
+    return image->promise.future();
+}
 
-            dataContainer.setAck(ack);
-            int completeSize = dataContainer.packetSize();
+void SecugenSda04::releaseImage(QByteArray &img)
+{
+    imagePool.release(img);
+}
 
-#ifdef QT_DEBUG
-            qDebug() << "Serial response :";
-            qDebug() << "ACK Error : " << dataContainer.stringError();
-            qDebug() << "Check sum : " << dataContainer.checkSum();
-            qDebug() << "Parameter 01 : " << dataContainer.param1();
-            qDebug() << "Parameter 02 : " << dataContainer.param2();
-            qDebug() << "ACK Packet size : " << completeSize;
-#endif
-            if(dataContainer.error() == SecugenSda04::ERROR_NONE)
-            {
-                if(completeSize > 0)
-                {
-#ifdef QT_DEBUG
-                    qDebug() << "get the data packet on the serial port ...";
-#endif
-                    QByteArray data = ack.right(ack.size() - 12);
+Sda04Reply *SecugenSda04::getImageAsync(int imageSize, Sda04Command::ChunkHandler handler)
+{
+    const quint16 sizeCmd = (imageSize == SecugenSda04::IMAGE_FULL_SIZE)? 0x0001 : 0x0002;
+
+    // Pixels are received right after the BMP header, in a buffer already sized for the file
+    Sda04Command command(0x43,sizeCmd);
+    command.packetBuffer = imagePool.acquire(imageSize);
+    command.packetOffset = Sda04Bitmap::HEADER_SIZE;
+    command.chunkHandler = handler;
+
+    return engine->submit(std::move(command), [imageSize](Sda04Reply *reply) {
+        return SecugenSda04::decodeImage(reply, imageSize);
+    }, Sda04Engine::PRIORITY_ENROLLMENT, [this](Sda04Reply *reply) {
+        // Connected before the command is queued, forwarded at once : the caller may be blocked on the reply
+        connect(reply, &Sda04Reply::progress, this, [this](qint64 received, qint64 total, qint64) {
+            emit partialComplete(received * 100 / total);
+        }, Qt::DirectConnection);
+    });
+}
 
-                    while(data.size() < completeSize)
-                        if(serial.waitForReadyRead(1000))
-                            data += serial.readAll();
+void SecugenSda04::cancel(Sda04Reply *reply)
+{
+    engine->cancel(reply);
+}
 
-#ifdef QT_DEBUG
-                    qDebug() << "data received (size : " << data.size() << ")";
-#endif
-                    if (data.size() > 0)
-                        dataContainer.setPacket(data);
-                }
+QVariant SecugenSda04::decodeImage(Sda04Reply *reply, int imageSize)
+{
+    QByteArray img = reply->takePacket();
 
-            } else {
-                emit sendError(dataContainer.error());
-            }
-        }
+    if(reply->error() != SecugenSda04::ERROR_NONE)
+        return QVariant(QByteArray());
 
+    if(!Sda04Bitmap::fromRaw(img, imageSize))
+    {
+        qWarning() << "Unexpected image size : " << img.size() - Sda04Bitmap::HEADER_SIZE;
+        return QVariant(QByteArray());
     }
 
-    serial.close();
+    qDebug() << "Image size        : " << img.size();
+
+    return QVariant(img);
 }
 
-QString SecugenSda04::characterToHexQString(const char character)
+QVariant SecugenSda04::waitResult(Sda04Reply *reply)
 {
-    QString result = QString::number(character, 16);
-    result = (result == "0") ? "00" : result;
-    return (result.length() == 1)? "0" + result : result;
+    reply->waitForFinished();
+    QVariant result = reply->result();
+    delete reply;
+
+    return result;
 }
 
-std::vector<int> SecugenSda04::intToHex(int id)
+quint16 SecugenSda04::userParam(int userID)
 {
-    QString ident = QString::number(id);
-    std::vector<int> hexValues(2);
+    return Sda04Command::toBcd(userID);
+}
+
+void SecugenSda04::executeCommand(const char cmd, DataContainer &dataContainer, const char param1Hight, const char param1Low, const char param2Hight, const char param2Low ,const char lwExtraDataHight,const char lwExtraDataLow,const char hwExtraDataHight,const char hwExtraDataLow, QByteArray data, quint32 baudRate)
+{
+    Sda04Command command(cmd,
+                         ((uchar)param1Hight << 8) | (uchar)param1Low,
+                         ((uchar)param2Hight << 8) | (uchar)param2Low,
+                         ((quint32)(uchar)hwExtraDataHight << 24) | ((uchar)hwExtraDataLow << 16) | ((uchar)lwExtraDataHight << 8) | (uchar)lwExtraDataLow,
+                         data, baudRate);
 
-    hexValues[0] = 0x00;
-    hexValues[1] = 0x00;
-    bool ok;
+    Sda04Reply *reply = engine->submit(command);
+    reply->waitForFinished();
 
-    if(ident.length() < 3)
-    {
-        hexValues[0] = ident.toUInt(&ok,16);
+    if(reply->timedOut())
+        error = true;
 
-    } else {
+    dataContainer.setAck(reply->ack());
+    dataContainer.setPacket(reply->packet());
 
-        hexValues[0] = ident.right(2).toUInt(&ok,16);
-        hexValues[1] = ident.left(ident.length()-2).toUInt(&ok,16);
-    }
+    delete reply;
+}
 
-    return hexValues;
+QString SecugenSda04::characterToHexQString(const char character)
+{
+    QString result = QString::number(character, 16);
+    result = (result == "0") ? "00" : result;
+    return (result.length() == 1)? "0" + result : result;
 }
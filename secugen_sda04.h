@@ -2,75 +2,22 @@
 #define SECUGENSDA04_H
 
 #include <QTimer>
+#include <QFuture>
 #include <ifingerprint.h>
 #include <QtSerialPort/QtSerialPort>
+#include <sda04_engine.h>
+#include <sda04_userindex.h>
+#include <sda04_templatestore.h>
+#include <sda04_template.h>
+#include <sda04_synccheckpoint.h>
+#include <sda04_bitmap.h>
+#include <sda04_quality.h>
+#include <sda04_archive.h>
+#ifndef SDA04_NO_WIRINGPI
 #include <wiringPi.h>
+#endif
 #include <QFile>
 
-#define HEADER_PICTURE_FULL_SIZE "424de63401000000000036040000280000000401000"\
-    "02c0100000100080000000000b0300100c21e0000c21e00000001000000000000000000"\
-    "00010101000202020003030300040404000505050006060600070707000808080009090"\
-    "9000a0a0a000b0b0b000c0c0c000d0d0d000e0e0e000f0f0f0010101000111111001212"\
-    "1200131313001414140015151500161616001717170018181800191919001a1a1a001b1"\
-    "b1b001c1c1c001d1d1d001e1e1e001f1f1f002020200021212100222222002323230024"\
-    "24240025252500262626002727270028282800292929002a2a2a002b2b2b002c2c2c002"\
-    "d2d2d002e2e2e002f2f2f00303030003131310032323200333333003434340035353500"\
-    "363636003737370038383800393939003a3a3a003b3b3b003c3c3c003d3d3d003e3e3e0"\
-    "03f3f3f0040404000414141004242420043434300444444004545450046464600474747"\
-    "0048484800494949004a4a4a004b4b4b004c4c4c004d4d4d004e4e4e004f4f4f0050505"\
-    "00051515100525252005353530054545400555555005656560057575700585858005959"\
-    "59005a5a5a005b5b5b005c5c5c005d5d5d005e5e5e005f5f5f006060600061616100626"\
-    "26200636363006464640065656500666666006767670068686800696969006a6a6a006b"\
-    "6b6b006c6c6c006d6d6d006e6e6e006f6f6f00707070007171710072727200737373007"\
-    "474740075757500767676007777770078787800797979007a7a7a007b7b7b007c7c7c00"\
-    "7d7d7d007e7e7e007f7f7f0080808000818181008282820083838300848484008585850"\
-    "0868686008787870088888800898989008a8a8a008b8b8b008c8c8c008d8d8d008e8e8e"\
-    "008f8f8f009090900091919100929292009393930094949400959595009696960097979"\
-    "70098989800999999009a9a9a009b9b9b009c9c9c009d9d9d009e9e9e009f9f9f00a0a0"\
-    "a000a1a1a100a2a2a200a3a3a300a4a4a400a5a5a500a6a6a600a7a7a700a8a8a800a9a"\
-    "9a900aaaaaa00ababab00acacac00adadad00aeaeae00afafaf00b0b0b000b1b1b100b2"\
-    "b2b200b3b3b300b4b4b400b5b5b500b6b6b600b7b7b700b8b8b800b9b9b900bababa00b"\
-    "bbbbb00bcbcbc00bdbdbd00bebebe00bfbfbf00c0c0c000c1c1c100c2c2c200c3c3c300"\
-    "c4c4c400c5c5c500c6c6c600c7c7c700c8c8c800c9c9c900cacaca00cbcbcb00cccccc0"\
-    "0cdcdcd00cecece00cfcfcf00d0d0d000d1d1d100d2d2d200d3d3d300d4d4d400d5d5d5"\
-    "00d6d6d600d7d7d700d8d8d800d9d9d900dadada00dbdbdb00dcdcdc00dddddd00deded"\
-    "e00dfdfdf00e0e0e000e1e1e100e2e2e200e3e3e300e4e4e400e5e5e500e6e6e600e7e7"\
-    "e700e8e8e800e9e9e900eaeaea00ebebeb00ececec00ededed00eeeeee00efefef00f0f"\
-    "0f000f1f1f100f2f2f200f3f3f300f4f4f400f5f5f500f6f6f600f7f7f700f8f8f800f9"\
-    "f9f900fafafa00fbfbfb00fcfcfc00fdfdfd00fefefe00ffffff00"
-
-#define HEADER_PICTURE_HALF_SIZE "424d8e510000000000003604000028000000820000"\
-    "00960000000100080000000000000000000000000000000000000000000000000000000"\
-    "00001010100020202000303030004040400050505000606060007070700080808000909"\
-    "09000a0a0a000b0b0b000c0c0c000d0d0d000e0e0e000f0f0f001010100011111100121"\
-    "21200131313001414140015151500161616001717170018181800191919001a1a1a001b"\
-    "1b1b001c1c1c001d1d1d001e1e1e001f1f1f00202020002121210022222200232323002"\
-    "424240025252500262626002727270028282800292929002a2a2a002b2b2b002c2c2c00"\
-    "2d2d2d002e2e2e002f2f2f0030303000313131003232320033333300343434003535350"\
-    "0363636003737370038383800393939003a3a3a003b3b3b003c3c3c003d3d3d003e3e3e"\
-    "003f3f3f004040400041414100424242004343430044444400454545004646460047474"\
-    "70048484800494949004a4a4a004b4b4b004c4c4c004d4d4d004e4e4e004f4f4f005050"\
-    "50005151510052525200535353005454540055555500565656005757570058585800595"\
-    "959005a5a5a005b5b5b005c5c5c005d5d5d005e5e5e005f5f5f00606060006161610062"\
-    "626200636363006464640065656500666666006767670068686800696969006a6a6a006"\
-    "b6b6b006c6c6c006d6d6d006e6e6e006f6f6f0070707000717171007272720073737300"\
-    "7474740075757500767676007777770078787800797979007a7a7a007b7b7b007c7c7c0"\
-    "07d7d7d007e7e7e007f7f7f008080800081818100828282008383830084848400858585"\
-    "00868686008787870088888800898989008a8a8a008b8b8b008c8c8c008d8d8d008e8e8"\
-    "e008f8f8f00909090009191910092929200939393009494940095959500969696009797"\
-    "970098989800999999009a9a9a009b9b9b009c9c9c009d9d9d009e9e9e009f9f9f00a0a"\
-    "0a000a1a1a100a2a2a200a3a3a300a4a4a400a5a5a500a6a6a600a7a7a700a8a8a800a9"\
-    "a9a900aaaaaa00ababab00acacac00adadad00aeaeae00afafaf00b0b0b000b1b1b100b"\
-    "2b2b200b3b3b300b4b4b400b5b5b500b6b6b600b7b7b700b8b8b800b9b9b900bababa00"\
-    "bbbbbb00bcbcbc00bdbdbd00bebebe00bfbfbf00c0c0c000c1c1c100c2c2c200c3c3c30"\
-    "0c4c4c400c5c5c500c6c6c600c7c7c700c8c8c800c9c9c900cacaca00cbcbcb00cccccc"\
-    "00cdcdcd00cecece00cfcfcf00d0d0d000d1d1d100d2d2d200d3d3d300d4d4d400d5d5d"\
-    "500d6d6d600d7d7d700d8d8d800d9d9d900dadada00dbdbdb00dcdcdc00dddddd00dede"\
-    "de00dfdfdf00e0e0e000e1e1e100e2e2e200e3e3e300e4e4e400e5e5e500e6e6e600e7e"\
-    "7e700e8e8e800e9e9e900eaeaea00ebebeb00ececec00ededed00eeeeee00efefef00f0"\
-    "f0f000f1f1f100f2f2f200f3f3f300f4f4f400f5f5f500f6f6f600f7f7f700f8f8f800f"\
-    "9f9f900fafafa00fbfbfb00fcfcfc00fdfdfd00fefefe00ffffff00"
-
 class Trigger : public QObject
 {
     Q_OBJECT
@@ -127,60 +74,42 @@ public:
 
     QString command()
     {
-        return "0x" + QString::number(m_ack[1], 16);
+        return "0x" + QString::number(Sda04Ack(m_ack).command(), 16);
     }
 
     QString param1()
     {
-        QString s1 = (QString::number(m_ack[3], 16).length() == 1)? ("0" + QString::number(m_ack[3], 16)) : QString::number(m_ack[3], 16);
-        QString s2 = (QString::number(m_ack[2], 16).length() == 1)? ("0" + QString::number(m_ack[2], 16)) : QString::number(m_ack[2], 16);
-
-        return "0x" + s1 + s2;
+        return "0x" + QString("%1").arg(Sda04Ack(m_ack).param1(), 4, 16, QChar('0'));
     }
 
     uint id()
     {
-        bool ok;
-        QString s1 = (QString::number(m_ack[3], 16).length() == 1)? ("0" + QString::number(m_ack[3], 16)) : QString::number(m_ack[3], 16);
-        QString s2 = (QString::number(m_ack[2], 16).length() == 1)? ("0" + QString::number(m_ack[2], 16)) : QString::number(m_ack[2], 16);
-
-        QString hexId = s1 + s2;
-        return hexId.toUInt(&ok,10);
+        return Sda04Ack(m_ack).userId();
     }
 
     QString param2()
     {
-        QString s1 = (QString::number(m_ack[5], 16).length() == 1)? ("0" + QString::number(m_ack[5], 16)) : QString::number(m_ack[5], 16);
-        QString s2 = (QString::number(m_ack[4], 16).length() == 1)? ("0" + QString::number(m_ack[4], 16)) : QString::number(m_ack[4], 16);
-
-        return  "0x" + s1 + s2;
+        return  "0x" + QString("%1").arg(Sda04Ack(m_ack).param2(), 4, 16, QChar('0'));
     }
 
     QString checkSum()
     {
-        return  "0x" + QString::number(m_ack[11], 16);
+        return  "0x" + QString::number(Sda04Ack(m_ack).checkSum(), 16);
     }
 
     QString stringError()
     {
-        return  "0x" + QString::number(m_ack[10], 16);
+        return  "0x" + QString::number(Sda04Ack(m_ack).error(), 16);
     }
 
     int error()
     {
-        return  m_ack[10];
+        return  Sda04Ack(m_ack).error();
     }
 
     uint packetSize()
     {
-        bool ok;
-        QString s1 = (QString::number(m_ack[9], 16).length() == 1)? ("0" + QString::number(m_ack[9], 16)) : QString::number(m_ack[9], 16);
-        QString s2 = (QString::number(m_ack[8], 16).length() == 1)? ("0" + QString::number(m_ack[8], 16)) : QString::number(m_ack[8], 16);
-        QString s3 = (QString::number(m_ack[7], 16).length() == 1)? ("0" + QString::number(m_ack[7], 16)) : QString::number(m_ack[7], 16);
-        QString s4 = (QString::number(m_ack[6], 16).length() == 1)? ("0" + QString::number(m_ack[6], 16)) : QString::number(m_ack[6], 16);
-
-        QString hexSize = "0x" + s1 + s2 + s3 + s4;
-        return hexSize.toUInt(&ok,16);
+        return Sda04Ack(m_ack).packetSize();
     }
 
 private:
@@ -195,19 +124,111 @@ class SecugenSda04 : public IFingerprint
     Q_ENUMS(ErrorReader)
 
 public:
+    // AutoOnPin : wiringPi pin of the reader's AutoOn line, NO_AUTOON : commands only (emulator, benchmarks)
     explicit SecugenSda04(const QString serialPort = "/dev/ttyAMA0", int AutoOnPin = 7);
+    ~SecugenSda04();
     void setSerialPort(qint32 baudRate);
+    bool openSession(qint32 baudRate = 0);
+    void closeSession();
+    bool reconnect();
+    bool isSessionOpen() const;
+    Sda04Engine::QueueStats queueStats(int priority) const;
+
+    // Per command timings and error counters, metricsSnapshot() every msecs (0 : stopped)
+    const Sda04Metrics &metrics() const;
+    void setMetricsInterval(int msecs);
+    // Default ACK deadline of a Sda04Engine::CommandClass, data packets get theirs from their size and the speed
+    void setAckTimeout(int commandClass, int msecs);
+    // Serial traffic capture for Sda04Replay, from now until stopRecording()
+    bool startRecording(const QString &fileName);
+    void stopRecording();
+
+    // Moves the link to the fastest speed accepted by the reader and the UART, checked with a status command.
+    // The result is remembered for the next start. Returns the speed in use, 0 if the reader doesn't answer.
+    qint32 negotiateBaudRate(qint32 maxBaudRate = QSerialPort::Baud115200);
+    qint32 baudRate() const;
+    // Startup negotiation done (ready() emitted) : commands sent before wait in the engine queues
+    bool isReady() const;
+    void waitForReady();
     QVariant scanFinger();
     bool verifyFinger(int userID);
+    // 0, the reader error (ERROR_TIMEOUT...), -1 : no answer, -2 : unexpected image size. img is empty on failure.
     int getImage(QByteArray &img, int imageSize = SecugenSda04::IMAGE_FULL_SIZE);
+    // Capture encoded on a pool thread, the serial thread only copies the rows as they arrive.
+    // The future holds an empty array if the capture failed (a BMP is passed through as it is). It always finishes,
+    // also when the command is dropped, and QFuture::cancel() stops the transfer once the image starts arriving.
+    QFuture<QByteArray> getImageEncoded(int format = SecugenSda04::IMAGE_PNG, int imageSize = SecugenSda04::IMAGE_FULL_SIZE);
+    // Returns a BMP from getImage() to the buffer pool (optional, saves an allocation on the next capture)
+    void releaseImage(QByteArray &img);
     int getuserIDavailable();
+    bool isUserIndexLoaded() const;
     QList<int> getuserIDs();
+    bool syncUserIndex();
+    bool verifyUserIndex();
 
     void autoOn();
 
+    // Pipeline mode : a touch starts identify at once, ending with identified(), unknownFinger() or identifyFailed().
+    // Edges closer than debounce ms, or during an identification, are ignored.
+    void setAutoIdentify(bool enabled, int debounce = SecugenSda04::TOUCH_DEBOUNCE);
+
+    // Reader error codes as documented in the decoders, -1 : no answer from the reader
     int registerNewUserStart(int userID);
     int registerNewUserEnd(int userID);
+
+    // Captures until an image passes Sda04Quality (at most attempts), the best scored one is left in img.
+    // Returns its quality, invalid if no image could be read.
+    Sda04Quality captureChecked(QByteArray &img, int attempts = SecugenSda04::QUALITY_ATTEMPTS, int imageSize = SecugenSda04::IMAGE_HALF_SIZE);
+    // Enrollment steps started only once a capture shows the finger well placed, 5 : no capture good enough.
+    // Advisory : the reader takes its own impression for 0x50 / 0x51 and has no command to enroll a host
+    // image, so the scored capture isn't the enrolled one. It only keeps a badly placed finger from
+    // reaching the reader, at the cost of one half size image transfer per attempt.
+    int registerNewUserStartWhenPlaced(int userID, int attempts = SecugenSda04::QUALITY_ATTEMPTS);
+    int registerNewUserEndWhenPlaced(int userID, int attempts = SecugenSda04::QUALITY_ATTEMPTS);
     int getHashUser(int userID, QString &hash64);
+
+    // Binary templates, as stored by the reader (base64 is only for getHashUser() and registerUser()).
+    // getTemplate() fills the caller's buffer in place when it has the capacity (QByteArray::reserve()), and gives it
+    // back empty on failure, so the next call reuses it.
+    int getTemplate(int userID, QByteArray &templates);
+    int putTemplate(int userID, const QByteArray &templates, bool replace = false, int format = SecugenSda04::ANSI378);
+
+    // Template copy between the reader and a host store (the store must stay open until the transfer ends)
+    int exportUser(int userID, Sda04TemplateStore &store);
+    int importUser(int userID, const Sda04TemplateStore &store, bool replace = false);
+
+    // Pushes to the reader only the records missing or changed since the last sync (progress on partialComplete()).
+    // Returns the number of records written, -1 if the store or checkpoint can't be used, -2 if the link was lost :
+    // calling it again with the same checkpoint resumes the transfer.
+    int syncTemplates(Sda04TemplateStore &store, const QString &checkpointFile, bool removeExtra = false);
+
+    // Whole database to a Sda04ArchiveWriter file on one open session, templates read SYNC_WINDOW at a time.
+    // With a previous archive the backup is presence only : a user still on the reader whose copy is intact is
+    // copied from it instead of being read. The reader gives no template checksum and its 0x7d entry only holds
+    // the ID, so a user deleted and enrolled again under the same ID keeps the old templates : take a full backup
+    // (no previous archive) after such changes. Returns the number of users saved, -1 : file error, -2 : link lost.
+    int backup(const QString &archiveFile, const QString &previousArchive = QString(), int format = SecugenSda04::ANSI378);
+    // Writes back every user whose checksum matches, returns the number written, -1 : file error, -2 : link lost
+    int restore(const QString &archiveFile, bool replace = true);
+
+    // Non blocking versions : the reply holds the result (caller owns it), its end is seen with onFinished().
+    // Identify/verify run first, then enrollment, then bulk database transfers.
+    // timeout : ms for the reader to answer, 0 : the capture class default (Sda04Engine::setAckTimeout)
+    Sda04Reply *scanFingerAsync(int timeout = 0);
+    Sda04Reply *verifyFingerAsync(int userID, int timeout = 0);
+    // Raw rows go to the handler while they arrive, progress on partialComplete() and the reply's progress()
+    Sda04Reply *getImageAsync(int imageSize = SecugenSda04::IMAGE_FULL_SIZE, Sda04Command::ChunkHandler handler = Sda04Command::ChunkHandler());
+    Sda04Reply *getuserIDsAsync();
+    Sda04Reply *registerNewUserStartAsync(int userID);
+    Sda04Reply *registerNewUserEndAsync(int userID);
+    Sda04Reply *getHashUserAsync(int userID, int priority = Sda04Engine::PRIORITY_BULK);
+    Sda04Reply *deleteUserAsync(int userID);
+    Sda04Reply *getTemplateAsync(int userID, int priority = Sda04Engine::PRIORITY_BULK, QByteArray buffer = QByteArray());
+    Sda04Reply *putTemplateAsync(const QByteArray &templates, int userID, bool replace = false, int format = SecugenSda04::ANSI378, int priority = Sda04Engine::PRIORITY_BULK);
+    Sda04Reply *registerUserAsync(const QString &hash, int userID, bool replace = false, int format = SecugenSda04::ANSI378, int priority = Sda04Engine::PRIORITY_BULK);
+    Sda04Reply *registerRecordAsync(const QByteArray &record, bool replace = false, int priority = Sda04Engine::PRIORITY_BULK);
+    // Stops a pending or running command, the reply finishes without result
+    void cancel(Sda04Reply *reply);
     QTimer *timerFinger;
 
     enum ErrorReader{
@@ -241,8 +262,18 @@ public:
     };
 
     enum formatMinutiae{
-        SG400 = 0,
-        ANSI378 = 1
+        SG400 = Sda04Template::FORMAT_SG400,
+        ANSI378 = Sda04Template::FORMAT_ANSI378
+    };
+
+    enum {
+        MAX_AUTOON_PINS = 64, // wiringPi pin numbers
+        NO_AUTOON = -1, // reader without an AutoOn line
+        TOUCH_DEBOUNCE = 50, // ms
+        QUALITY_ATTEMPTS = 3, // placement captures before an enrollment step gives up
+        SYNC_WINDOW = 4, // commands kept queued during a sync, the reader never waits for the host
+        PROBE_TIMEOUT = 300, // ms, status answer during a speed probe
+        PROBE_RETRIES = 3 // status probes while the reader settles on a new speed
     };
 
     enum ImageSize{
@@ -250,20 +281,57 @@ public:
         IMAGE_HALF_SIZE = 1
     };
 
+    enum ImageFormat{
+        IMAGE_BMP = 0, // 8 bits uncompressed, as getImage()
+        IMAGE_PNG = 1 // lossless, about a third of the BMP for a capture
+    };
+
 protected:
     bool error;
-    void executeCommand(const char cmd, DataContainer &dataContainer, const char param1Hight = 0x00, const char param1Low = 0x00, const char param2Hight = 0x00, const char param2Low = 0x00,const char lwExtraDataHight = 0x00,const char lwExtraDataLow = 0x00,const char hwExtraDataHight = 0x00,const char hwExtraDataLow = 0x00, QByteArray data= QByteArray(), quint32 baudRate = QSerialPort::Baud57600);
+    void executeCommand(const char cmd, DataContainer &dataContainer, const char param1Hight = 0x00, const char param1Low = 0x00, const char param2Hight = 0x00, const char param2Low = 0x00,const char lwExtraDataHight = 0x00,const char lwExtraDataLow = 0x00,const char hwExtraDataHight = 0x00,const char hwExtraDataLow = 0x00, QByteArray data= QByteArray(), quint32 baudRate = 0);
 
 private:
-    QSerialPort serial;
+    // Only an enrollment reserves IDs : it always releases them when it ends, fails or is deleted
+    friend class Sda04Enrollment;
+
+    Sda04Engine *engine;
+    QThread workerThread;
+    Sda04UserIndex userIndex;
+    Sda04BitmapPool imagePool;
+    Trigger trigger;
+    int autoOnPin;
+    QElapsedTimer touchClock;
+    QAtomicInt touchDebounce;
+    QAtomicInteger<qint64> lastTouch; // ms on touchClock, which counts from the reader's creation
+    QAtomicInt identifying;
+    QTimer metricsTimer;
+    QFuture<void> startup;
     QByteArray response;
     QString serialPort;
-    int timeoutSerial;
-    int integerFromArray(QByteArray array, int start, int lenght = 2);
+    QVariant waitResult(Sda04Reply *reply);
+    // Held for an enrollment in progress : not returned by getuserIDavailable() until released
+    int reserveUserID();
+    void releaseUserID(int userID);
+    bool pipeline(const QList<int> &ids, std::function<Sda04Reply *(int)> submit, std::function<void (int, Sda04Reply *)> done, int &progress, const int &total);
+    quint16 userParam(int userID);
+    bool probeBaudRate(qint32 baudRate);
+    qint32 findBaudRate(qint32 preferred);
+    QString settingsKey() const;
+    void start();
+    static QVariant decodeIdentify(Sda04Reply *reply);
+    static QVariant decodeVerify(Sda04Reply *reply);
+    static QVariant decodeImage(Sda04Reply *reply, int imageSize);
+    static QVariant decodeUserIDs(Sda04Reply *reply);
+    static QVariant decodeRegisterStart(Sda04Reply *reply);
+    static QVariant decodeRegisterEnd(Sda04Reply *reply);
+    static QVariant decodeTemplate(Sda04Reply *reply);
+    static QVariant decodeHash(Sda04Reply *reply);
+    static QVariant decodeDelete(Sda04Reply *reply);
+    static QVariant decodeRegisterUser(Sda04Reply *reply);
     QString characterToHexQString(const char character);
-    std::vector<int> intToHex(int id);
 
 private slots:
+    void touched();
     void checkFingerTouch() {
         // Not used
     }
@@ -271,12 +339,21 @@ private slots:
 public slots:
     void waitForFinger();
     void stopWaitForFinger();
+    // 1 : user not found, 2 : flash write error, -1 : no answer from the reader
     int deleteUser(int userID);
-    int registerUser(QString hash, int userID, bool replace = false, int format = SecugenSda04::ANSI378);
+    // -1 : insufficient data, -2 : invalid record, -3 : no answer from the reader
+    int registerUser(const QString &hash, int userID, bool replace = false, int format = SecugenSda04::ANSI378);
 
 signals:
     void resultReady(DataContainer *data);
     void partialComplete(int percentage);
+    void metricsSnapshot(const QVariantMap &metrics);
+    // Startup negotiation result, detected is false if the reader never answered
+    void ready(bool detected);
+    // Pipeline mode result, emitted from the serial thread
+    void identified(int userID);
+    // Pipeline mode, no decision : -3, the reader timed out or didn't answer
+    void identifyFailed(int error);
 
 };
 